@@ -0,0 +1,24 @@
+@tool
+extends EditorScript
+
+# Replacing the bytecode of a data-only script must drop the extracted data.
+# Run with File -> Run in the Script Editor.
+func _run() -> void:
+	var script := SquirrelScript.new()
+	script.source = "return { answer = 42 }"
+	assert(script.compile() == OK)
+	assert(script.extract_data())
+	assert(script.data == { "answer": 42 })
+
+	var other := SquirrelScript.new()
+	other.source = "return { answer = 43 }"
+	assert(other.compile() == OK)
+
+	script.bytecode = other.bytecode
+	assert(script.data == null)
+
+	var vm := SquirrelVM.new()
+	var result: SquirrelTable = vm.import_data(script)
+	assert(result.get_slot("answer") == 43)
+
+	print("test_data_script passed")
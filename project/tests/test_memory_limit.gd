@@ -0,0 +1,31 @@
+@tool
+extends EditorScript
+
+const SOURCE := """
+local t = {};
+try {
+	for (local i = 0; ; i++)
+		t[i] <- i;
+} catch (e) {
+	t = null;
+	return e;
+}
+"""
+
+# A script that allocates in a loop without calling Godot must be stopped by
+# the memory limit, with an error it can catch.
+# Run with File -> Run in the Script Editor.
+func _run() -> void:
+	var script := SquirrelScript.new()
+	script.source = SOURCE
+	assert(script.compile() == OK)
+
+	var vm := SquirrelVM.new()
+	vm.memory_limit = 4 * 1024 * 1024
+	var result: Variant = vm.call_function(vm.import(script), vm.root_table)
+	assert(result == "out of memory")
+
+	vm.collect_garbage()
+	assert(vm.get_memory_usage() <= vm.memory_limit)
+
+	print("test_memory_limit passed")
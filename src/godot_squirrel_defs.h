@@ -1,6 +1,8 @@
 #pragma once
 
 #include <godot_cpp/classes/resource.hpp>
+#include <godot_cpp/templates/hash_map.hpp>
+#include <godot_cpp/variant/typed_array.hpp>
 #include <godot_cpp/variant/typed_dictionary.hpp>
 
 #include <gdextension_interface.h>
@@ -13,7 +15,23 @@
 #define SQUIRREL_INITIAL_STACK_SIZE 128
 #endif
 
+// smallest stack create_thread will allocate; twice Squirrel's MIN_STACK_OVERHEAD
+#ifndef SQUIRREL_MIN_STACK_SIZE
+#define SQUIRREL_MIN_STACK_SIZE 30
+#endif
+
+// default for SquirrelVM.thread_pool_limit
+#ifndef SQUIRREL_THREAD_POOL_LIMIT
+#define SQUIRREL_THREAD_POOL_LIMIT 64
+#endif
+
+// SquirrelVM.collect_garbage_step never collects after less growth than this
+#ifndef SQUIRREL_GC_MIN_GROWTH
+#define SQUIRREL_GC_MIN_GROWTH (256 * 1024)
+#endif
+
 class SquirrelThrow;
+struct SquirrelCompileResult;
 
 class SquirrelScript : public godot::Resource {
 	GDCLASS(SquirrelScript, godot::Resource);
@@ -24,11 +42,22 @@ protected:
 private:
 	godot::String _source;
 	godot::PackedByteArray _bytecode;
+	godot::Variant _data;
 
 	godot::String _error_desc;
 	godot::String _error_source;
 	int64_t _error_line = -1;
 	int64_t _error_column = -1;
+	godot::Dictionary _compile_statistics;
+
+	void _apply_compile_result(const SquirrelCompileResult &p_result);
+	godot::Error _compile(const godot::String &p_debug_file_name, bool p_optimize, bool p_debug_info, SquirrelCompileResult &r_result);
+#ifndef SQUIRREL_NO_IMPORTER
+	friend class SquirrelEditorImportPlugin;
+#endif
+
+	static godot::String _bytecode_cache_dir;
+	[[nodiscard]] godot::String _get_bytecode_cache_file(const godot::String &p_file_name) const;
 
 public:
 	[[nodiscard]] godot::String get_source() const;
@@ -37,6 +66,9 @@ public:
 	[[nodiscard]] godot::PackedByteArray get_bytecode() const;
 	void set_bytecode(const godot::PackedByteArray &p_bytecode);
 
+	[[nodiscard]] godot::Variant get_data() const;
+	void set_data(const godot::Variant &p_data);
+
 	[[nodiscard]] godot::String get_error_desc() const;
 	[[nodiscard]] godot::String get_error_source() const;
 	[[nodiscard]] int64_t get_error_line() const;
@@ -47,7 +79,48 @@ public:
 	void set_error_line(int64_t p_error_line);
 	void set_error_column(int64_t p_error_column);
 
-	godot::Error compile(const godot::String &p_debug_file_name = godot::String());
+	godot::Error compile(const godot::String &p_debug_file_name = godot::String(), bool p_optimize = false, bool p_debug_info = true);
+	static godot::TypedArray<godot::Dictionary> compile_batch(const godot::TypedArray<SquirrelScript> &p_scripts, bool p_optimize = false, bool p_debug_info = true);
+	godot::Error compile_cached(const godot::String &p_debug_file_name = godot::String());
+	[[nodiscard]] godot::Dictionary get_compile_statistics() const;
+	bool extract_data();
+	static godot::Dictionary eliminate_dead_functions(const godot::TypedArray<SquirrelScript> &p_scripts, const godot::PackedStringArray &p_keep = godot::PackedStringArray());
+
+	static void set_bytecode_cache_dir(const godot::String &p_dir);
+	[[nodiscard]] static godot::String get_bytecode_cache_dir();
+	static void clear_bytecode_cache();
+};
+
+class SquirrelScriptBundle : public godot::Resource {
+	GDCLASS(SquirrelScriptBundle, godot::Resource);
+
+protected:
+	static void _bind_methods();
+
+private:
+	godot::PackedStringArray _names;
+	godot::PackedInt64Array _offsets;
+	godot::PackedByteArray _data;
+
+	godot::HashMap<godot::String, int64_t> _index;
+	void _rebuild_index();
+
+public:
+	[[nodiscard]] godot::PackedStringArray get_names() const;
+	void set_names(const godot::PackedStringArray &p_names);
+	[[nodiscard]] godot::PackedInt64Array get_offsets() const;
+	void set_offsets(const godot::PackedInt64Array &p_offsets);
+	[[nodiscard]] godot::PackedByteArray get_data() const;
+	void set_data(const godot::PackedByteArray &p_data);
+
+	godot::Error add_script(const godot::String &p_name, const godot::Ref<SquirrelScript> &p_script);
+	[[nodiscard]] bool has_script(const godot::String &p_name) const;
+	[[nodiscard]] godot::Ref<SquirrelScript> get_bundled_script(const godot::String &p_name) const;
+	[[nodiscard]] int64_t get_script_count() const;
+	void clear();
+
+	// borrows a pointer into the bundle's data; valid until the bundle is modified
+	bool get_bytecode_range(const godot::String &p_name, const uint8_t *&r_data, int64_t &r_size) const;
 };
 
 #ifndef SQUIRREL_NO_IMPORTER
@@ -134,6 +207,7 @@ protected:
 	struct SquirrelVariantInternal;
 	friend struct SquirrelVariantInternal;
 	friend class SquirrelVMBase;
+	friend class SquirrelVM;
 	friend class SquirrelUserData;
 	friend class SquirrelIterator;
 	SquirrelVariantInternal *_internal = nullptr;
@@ -211,9 +285,12 @@ public:
 
 	[[nodiscard]] godot::Ref<SquirrelFunction> import(const godot::Ref<SquirrelScript> &p_script, const godot::String &p_debug_file_name = godot::String());
 	[[nodiscard]] godot::Ref<SquirrelFunction> import_script(const godot::String &p_script, const godot::String &p_debug_file_name = godot::String());
+	[[nodiscard]] godot::Variant import_data(const godot::Ref<SquirrelScript> &p_script);
+	[[nodiscard]] godot::Ref<SquirrelFunction> import_from_bundle(const godot::Ref<SquirrelScriptBundle> &p_bundle, const godot::String &p_name);
 	void import_blob();
 	void import_math();
 	void import_string();
+	void import_stdlib_lazy(bool p_blob = true, bool p_math = true, bool p_string = true);
 	godot::Variant call_function(const godot::Variant **p_args, GDExtensionInt p_arg_count, GDExtensionCallError &r_error);
 	godot::Variant apply_function(const godot::Ref<SquirrelCallable> &p_func, const godot::Variant &p_this, const godot::Array &p_args);
 	godot::Variant apply_function_catch(const godot::Ref<SquirrelCallable> &p_func, const godot::Variant &p_this, const godot::Array &p_args);
@@ -238,7 +315,7 @@ public:
 	[[nodiscard]] godot::Ref<SquirrelTable> create_table();
 	[[nodiscard]] godot::Ref<SquirrelTable> create_table_with_initial_capacity(int64_t p_size);
 	[[nodiscard]] godot::Ref<SquirrelArray> create_array(int64_t p_size);
-	[[nodiscard]] godot::Ref<SquirrelThread> create_thread();
+	[[nodiscard]] godot::Ref<SquirrelThread> create_thread(int64_t p_stack_size = 0);
 	[[nodiscard]] godot::Ref<SquirrelUserData> wrap_variant(const godot::Variant &p_value);
 	[[nodiscard]] godot::Ref<SquirrelUserData> intern_variant(const godot::Variant &p_value);
 	[[nodiscard]] godot::Ref<SquirrelNativeFunction> wrap_callable(const godot::Callable &p_callable, bool p_varargs);
@@ -247,6 +324,8 @@ public:
 	[[nodiscard]] godot::Variant convert_variant(const godot::Variant &p_value, bool p_wrap_unhandled_values);
 
 	int64_t collect_garbage();
+	bool shrink_stack();
+	[[nodiscard]] int64_t get_stack_memory_usage() const;
 	godot::TypedArray<SquirrelVariant> resurrect_unreachable();
 
 	void set_error_handler(const godot::Ref<SquirrelAnyFunction> &p_func);
@@ -307,6 +386,31 @@ public:
 
 	void clear_interned_variants();
 
+	void set_memory_limit(int64_t p_memory_limit);
+	[[nodiscard]] int64_t get_memory_limit() const;
+	[[nodiscard]] int64_t get_memory_usage() const;
+
+	bool collect_garbage_step(int64_t p_budget_usec);
+	void set_gc_growth_ratio(double p_gc_growth_ratio);
+	[[nodiscard]] double get_gc_growth_ratio() const;
+	[[nodiscard]] godot::Dictionary get_gc_statistics() const;
+
+	[[nodiscard]] godot::Dictionary get_heap_census() const;
+	void start_allocation_profile(int64_t p_sample_interval = 512 * 1024);
+	void stop_allocation_profile();
+	[[nodiscard]] godot::Dictionary get_allocation_profile() const;
+	[[nodiscard]] godot::Dictionary take_heap_snapshot() const;
+	[[nodiscard]] static godot::Dictionary diff_heap_snapshots(const godot::Dictionary &p_before, const godot::Dictionary &p_after);
+
+	[[nodiscard]] godot::Ref<SquirrelVM> fork() const;
+	bool recycle_thread(const godot::Ref<SquirrelThread> &p_thread);
+	void set_thread_pool_limit(int64_t p_thread_pool_limit);
+	[[nodiscard]] int64_t get_thread_pool_limit() const;
+	[[nodiscard]] godot::Dictionary get_thread_pool_statistics() const;
+	[[nodiscard]] godot::Ref<SquirrelThread> create_thread_with_root_table(const godot::Ref<SquirrelTable> &p_root_table = godot::Ref<SquirrelTable>());
+	[[nodiscard]] godot::PackedByteArray save_image() const;
+	godot::Error load_image(const godot::PackedByteArray &p_image, const godot::Dictionary &p_natives = godot::Dictionary());
+
 	[[nodiscard]] godot::Ref<SquirrelTable> get_table_default_delegate() const;
 	[[nodiscard]] godot::Ref<SquirrelTable> get_array_default_delegate() const;
 	[[nodiscard]] godot::Ref<SquirrelTable> get_string_default_delegate() const;
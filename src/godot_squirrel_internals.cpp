@@ -14,6 +14,18 @@
 #include "../squirrel/squirrel/sqclass.h"
 // clang-format on
 
+#ifdef SQUIRREL_NO_COMPILER
+// replaces sqcompiler.cpp so that sq_compile and compilestring fail instead of failing to link
+bool Compile(SQVM *vm, SQLEXREADFUNC rg, SQUserPointer up, const SQChar *sourcename, SQObjectPtr &out, bool raiseerror, bool lineinfo) {
+	const SQChar *error = _SC("the Squirrel compiler is not included in this build");
+	if (raiseerror && _ss(vm)->_compilererrorhandler) {
+		_ss(vm)->_compilererrorhandler(vm, error, sourcename ? sourcename : _SC("unknown"), 0, 0);
+	}
+	vm->_lasterror = SQString::Create(_ss(vm), error, -1);
+	return false;
+}
+#endif
+
 SQInteger godot_squirrel_get_generator_state(const HSQOBJECT *obj) {
 	if (!sq_isgenerator(*obj)) {
 		return SQ_VMSTATE_IDLE;
@@ -34,3 +46,2402 @@ void godot_squirrel_push_call_closure(HSQUIRRELVM vm, SQInteger level) {
 	const SQVM::CallInfo &ci = vm->_callsstack[vm->_callsstacksize - level - 1];
 	sq_pushobject(vm, ci._closure);
 }
+
+SQRESULT godot_squirrel_get_closure_proto(HSQUIRRELVM vm, SQInteger idx, HSQOBJECT *proto) {
+	HSQOBJECT obj;
+	if (SQ_FAILED(sq_getstackobj(vm, idx, &obj)) || !sq_isclosure(obj)) {
+		return sq_throwerror(vm, _SC("expected a closure"));
+	}
+
+	proto->_type = OT_FUNCPROTO;
+	proto->_unVal.pFunctionProto = obj._unVal.pClosure->_function;
+
+	return SQ_OK;
+}
+
+SQRESULT godot_squirrel_new_closure_from_proto(HSQUIRRELVM vm, const HSQOBJECT *proto) {
+	if (sq_type(*proto) != OT_FUNCPROTO) {
+		return sq_throwerror(vm, _SC("expected a function prototype"));
+	}
+
+	SQFunctionProto *func = proto->_unVal.pFunctionProto;
+	if (func->_noutervalues != 0) {
+		return sq_throwerror(vm, _SC("cannot create a closure with free variables from a prototype"));
+	}
+
+	// same as the tail of SQClosure::Load
+	vm->Push(SQObjectPtr(SQClosure::Create(_ss(vm), func, _table(vm->_roottable)->GetWeakRef(OT_TABLE))));
+
+	return SQ_OK;
+}
+
+// the target of a jump is relative to the instruction after it, except for
+// _OP_POSTFOREACH, which the VM adjusts by one (see SQVM::Execute).
+static bool get_jump_target(const SQInstruction &inst, SQInteger index, SQInteger &target) {
+	switch (inst.op) {
+		case _OP_JMP:
+		case _OP_JZ:
+		case _OP_JCMP:
+		case _OP_AND:
+		case _OP_OR:
+		case _OP_FOREACH:
+		case _OP_PUSHTRAP:
+			target = index + 1 + inst._arg1;
+			return true;
+		case _OP_POSTFOREACH:
+			target = index + inst._arg1;
+			return true;
+		default:
+			return false;
+	}
+}
+
+static void set_jump_target(SQInstruction &inst, SQInteger index, SQInteger target) {
+	inst._arg1 = static_cast<SQInt32>(inst.op == _OP_POSTFOREACH ? target - index : target - index - 1);
+}
+
+static bool can_thread_jump(const SQInstruction &inst) {
+	switch (inst.op) {
+		case _OP_JMP:
+		case _OP_JZ:
+		case _OP_JCMP:
+		case _OP_AND:
+		case _OP_OR:
+			return true;
+		default:
+			return false;
+	}
+}
+
+static bool falls_through(const SQInstruction &inst) {
+	return inst.op != _OP_JMP && inst.op != _OP_RETURN && inst.op != _OP_THROW;
+}
+
+// loads a constant into a register; doing it twice in a row is redundant
+static bool is_constant_load(const SQInstruction &inst) {
+	switch (inst.op) {
+		case _OP_LOAD:
+		case _OP_LOADINT:
+		case _OP_LOADFLOAT:
+		case _OP_LOADBOOL:
+		case _OP_LOADNULLS:
+			return true;
+		default:
+			return false;
+	}
+}
+
+static bool same_instruction(const SQInstruction &a, const SQInstruction &b) {
+	return a.op == b.op && a._arg0 == b._arg0 && a._arg1 == b._arg1 && a._arg2 == b._arg2 && a._arg3 == b._arg3;
+}
+
+// runs one round of jump threading and instruction removal. returns false if nothing was removed.
+static bool optimize_instructions(SQFunctionProto *func) {
+	const SQInteger count = func->_ninstructions;
+	SQInstruction *code = func->_instructions;
+
+	// jump threading: a jump to an unconditional jump can go straight to its destination
+	for (SQInteger i = 0; i < count; i++) {
+		SQInteger target = 0;
+		if (!can_thread_jump(code[i]) || !get_jump_target(code[i], i, target)) {
+			continue;
+		}
+
+		const SQInteger original = target;
+		for (SQInteger steps = 0; steps < count && target >= 0 && target < count && code[target].op == _OP_JMP; steps++) {
+			const SQInteger next = target + 1 + code[target]._arg1;
+			if (next == target) {
+				break; // infinite loop
+			}
+			target = next;
+		}
+
+		if (target != original) {
+			set_jump_target(code[i], i, target);
+		}
+	}
+
+	sqvector<SQInteger> reachable;
+	sqvector<SQInteger> is_target;
+	reachable.resize(count, 0);
+	is_target.resize(count + 1, 0);
+
+	sqvector<SQInteger> pending;
+	pending.push_back(0);
+	while (!pending.empty()) {
+		const SQInteger i = pending.top();
+		pending.pop_back();
+		if (i < 0 || i >= count || reachable[i]) {
+			continue;
+		}
+		reachable[i] = 1;
+
+		SQInteger target = 0;
+		if (get_jump_target(code[i], i, target) && target >= 0 && target <= count) {
+			is_target[target] = 1;
+			pending.push_back(target);
+		}
+		if (code[i].op == _OP_FOREACH && i + 2 <= count) {
+			// SQVM::FOREACH_OP skips the _OP_POSTFOREACH that follows it
+			is_target[i + 2] = 1;
+			pending.push_back(i + 2);
+		}
+		if (falls_through(code[i])) {
+			pending.push_back(i + 1);
+		}
+	}
+
+	sqvector<SQInteger> new_index;
+	new_index.resize(count + 1, 0);
+	SQInteger kept = 0;
+	for (SQInteger i = 0; i < count; i++) {
+		new_index[i] = kept;
+
+		SQInteger target = 0;
+		bool keep = reachable[i] != 0;
+		if (keep && code[i].op == _OP_JMP && get_jump_target(code[i], i, target) && target == i + 1) {
+			keep = false; // jump to the next instruction
+		} else if (keep && code[i].op == _OP_MOVE && code[i]._arg0 == code[i]._arg1) {
+			keep = false; // move to self
+		} else if (keep && i > 0 && !is_target[i] && reachable[i - 1] && is_constant_load(code[i]) && same_instruction(code[i], code[i - 1])) {
+			keep = false; // the register already holds this value
+		}
+
+		if (keep) {
+			kept++;
+		} else {
+			code[i].op = 0xFF; // marker; never executed
+		}
+	}
+	new_index[count] = kept;
+
+	if (kept == count) {
+		return false;
+	}
+
+	SQInteger out = 0;
+	for (SQInteger i = 0; i < count; i++) {
+		if (code[i].op == 0xFF) {
+			continue;
+		}
+
+		SQInstruction inst = code[i];
+		SQInteger target = 0;
+		if (get_jump_target(inst, i, target)) {
+			target = target < 0 ? 0 : (target > count ? count : target);
+			set_jump_target(inst, out, new_index[target]);
+		}
+		code[out++] = inst;
+	}
+	func->_ninstructions = kept;
+
+	// keep the last entry for each instruction, as the earlier ones described removed instructions
+	SQInteger lines = 0;
+	for (SQInteger i = 0; i < func->_nlineinfos; i++) {
+		SQLineInfo info = func->_lineinfos[i];
+		info._op = new_index[info._op < 0 ? 0 : (info._op > count ? count : info._op)];
+		if (lines > 0 && func->_lineinfos[lines - 1]._op == info._op) {
+			func->_lineinfos[lines - 1] = info;
+		} else {
+			func->_lineinfos[lines++] = info;
+		}
+	}
+	func->_nlineinfos = lines;
+
+	for (SQInteger i = 0; i < func->_nlocalvarinfos; i++) {
+		SQLocalVarInfo &info = func->_localvarinfos[i];
+		const SQUnsignedInteger start = new_index[info._start_op < SQUnsignedInteger(count) ? info._start_op : count];
+		const SQUnsignedInteger end_next = new_index[info._end_op + 1 < SQUnsignedInteger(count) ? info._end_op + 1 : count];
+		info._start_op = start;
+		info._end_op = end_next > start ? end_next - 1 : start;
+	}
+
+	return true;
+}
+
+static void optimize_proto(SQFunctionProto *func, SQInteger &before, SQInteger &after) {
+	before += func->_ninstructions;
+
+	while (optimize_instructions(func)) {
+	}
+
+	after += func->_ninstructions;
+
+	for (SQInteger i = 0; i < func->_nfunctions; i++) {
+		optimize_proto(_funcproto(func->_functions[i]), before, after);
+	}
+}
+
+SQRESULT godot_squirrel_optimize_closure(HSQUIRRELVM vm, SQInteger idx, SQInteger *instructions_before, SQInteger *instructions_after) {
+	HSQOBJECT obj;
+	if (SQ_FAILED(sq_getstackobj(vm, idx, &obj)) || !sq_isclosure(obj)) {
+		return sq_throwerror(vm, _SC("expected a closure"));
+	}
+
+	SQInteger before = 0;
+	SQInteger after = 0;
+	optimize_proto(obj._unVal.pClosure->_function, before, after);
+
+	if (instructions_before) {
+		*instructions_before = before;
+	}
+	if (instructions_after) {
+		*instructions_after = after;
+	}
+
+	return SQ_OK;
+}
+
+// a closure is data-only if running it can only build tables and arrays out of
+// literals and return one of them: no calls, no global access, and no reads of
+// the "this" register (which is how top-level slot assignments reach the root table).
+static bool is_data_only_proto(const SQFunctionProto *func) {
+	if (func->_nfunctions != 0 || func->_noutervalues != 0 || func->_varparams || func->_nparameters != 1) {
+		return false;
+	}
+
+	for (SQInteger i = 0; i < func->_ninstructions; i++) {
+		const SQInstruction &inst = func->_instructions[i];
+		switch (inst.op) {
+			case _OP_LINE:
+			case _OP_LOAD:
+			case _OP_LOADINT:
+			case _OP_LOADFLOAT:
+			case _OP_LOADBOOL:
+			case _OP_LOADNULLS:
+			case _OP_DLOAD:
+				break;
+			case _OP_NEWOBJ:
+				if (inst._arg3 != NOT_TABLE && inst._arg3 != NOT_ARRAY) {
+					return false;
+				}
+				break;
+			case _OP_MOVE:
+				if (inst._arg1 == 0) {
+					return false;
+				}
+				break;
+			case _OP_NEWSLOT:
+				if (inst._arg1 == 0 || inst._arg2 == 0 || inst._arg3 == 0) {
+					return false;
+				}
+				break;
+			case _OP_APPENDARRAY:
+				if (inst._arg0 == 0 || (inst._arg2 == AAT_STACK && inst._arg1 == 0)) {
+					return false;
+				}
+				break;
+			case _OP_RETURN:
+				if (inst._arg0 != 0xFF && inst._arg1 == 0) {
+					return false;
+				}
+				break;
+			default:
+				return false;
+		}
+	}
+
+	return true;
+}
+
+SQBool godot_squirrel_is_data_only_closure(HSQUIRRELVM vm, SQInteger idx) {
+	HSQOBJECT obj;
+	if (SQ_FAILED(sq_getstackobj(vm, idx, &obj)) || !sq_isclosure(obj)) {
+		return SQFalse;
+	}
+
+	return is_data_only_proto(obj._unVal.pClosure->_function) ? SQTrue : SQFalse;
+}
+
+namespace {
+struct ProtoRef {
+	SQFunctionProto *func;
+	SQFunctionProto *parent;
+	SQInteger index;
+	SQInteger end; // protos are listed depth first, so [self, end) is the subtree
+	SQInteger next_same_name;
+	bool removed;
+};
+} //namespace
+
+// called implicitly by the VM, so they are never referenced by name
+static const SQChar *const implicit_member_names[] = {
+	_SC("constructor"),
+	_SC("_set"),
+	_SC("_get"),
+	_SC("_newslot"),
+	_SC("_delslot"),
+	_SC("_add"),
+	_SC("_sub"),
+	_SC("_mul"),
+	_SC("_div"),
+	_SC("_unm"),
+	_SC("_modulo"),
+	_SC("_typeof"),
+	_SC("_call"),
+	_SC("_cloned"),
+	_SC("_nexti"),
+	_SC("_cmp"),
+	_SC("_tostring"),
+	_SC("_inherited"),
+	_SC("_newmember"),
+};
+
+static void collect_protos(SQFunctionProto *func, SQFunctionProto *parent, SQInteger index, sqvector<ProtoRef> &protos) {
+	const SQUnsignedInteger self = protos.size();
+	ProtoRef ref;
+	ref.func = func;
+	ref.parent = parent;
+	ref.index = index;
+	ref.end = -1;
+	ref.next_same_name = -1;
+	ref.removed = false;
+	protos.push_back(ref);
+
+	for (SQInteger i = 0; i < func->_nfunctions; i++) {
+		collect_protos(_funcproto(func->_functions[i]), func, i, protos);
+	}
+
+	protos[self].end = SQInteger(protos.size());
+}
+
+static SQInteger count_instructions(const SQFunctionProto *func) {
+	SQInteger count = func->_ninstructions;
+	for (SQInteger i = 0; i < func->_nfunctions; i++) {
+		count += count_instructions(_funcproto(func->_functions[i]));
+	}
+	return count;
+}
+
+// the number of instructions that read the given literal
+static SQInteger count_literal_uses(const SQFunctionProto *func, SQInteger literal) {
+	SQInteger uses = 0;
+	for (SQInteger i = 0; i < func->_ninstructions; i++) {
+		const SQInstruction &inst = func->_instructions[i];
+		switch (inst.op) {
+			case _OP_LOAD:
+			case _OP_PREPCALLK:
+			case _OP_GETK:
+				uses += inst._arg1 == literal;
+				break;
+			case _OP_DLOAD:
+				uses += inst._arg1 == literal;
+				uses += SQInteger(inst._arg3) == literal;
+				break;
+			case _OP_APPENDARRAY:
+				uses += inst._arg2 == AAT_LITERAL && inst._arg1 == literal;
+				break;
+			case _OP_EQ:
+			case _OP_NE:
+				uses += inst._arg3 != 0 && inst._arg1 == literal;
+				break;
+			default:
+				break;
+		}
+	}
+	return uses;
+}
+
+// a function is only removed if its name is loaded exactly once, directly
+// before the closure is created (the key of `function name() {}`), and no
+// other function in any script contains the name as a literal.
+static bool is_dead_function(const ProtoRef &ref, SQTable *presence, SQTable *keep) {
+	const SQFunctionProto *func = ref.func;
+	if (ref.parent == nullptr || sq_type(func->_name) != OT_STRING) {
+		return false;
+	}
+
+	// nothing left to remove
+	if (func->_nfunctions == 0 && func->_ninstructions <= 1) {
+		return false;
+	}
+
+	SQObjectPtr value;
+	if (keep->Get(func->_name, value)) {
+		return false;
+	}
+	for (const SQChar *name : implicit_member_names) {
+		if (scstrcmp(_stringval(func->_name), name) == 0) {
+			return false;
+		}
+	}
+
+	if (!presence->Get(func->_name, value) || _integer(value) != 1) {
+		return false;
+	}
+
+	const SQFunctionProto *parent = ref.parent;
+	SQInteger literal = -1;
+	for (SQInteger i = 0; i < parent->_nliterals; i++) {
+		if (sq_type(parent->_literals[i]) == OT_STRING && _string(parent->_literals[i]) == _string(func->_name)) {
+			literal = i;
+			break;
+		}
+	}
+	if (literal < 0 || count_literal_uses(parent, literal) != 1) {
+		return false;
+	}
+
+	for (SQInteger i = 0; i + 1 < parent->_ninstructions; i++) {
+		const SQInstruction &load = parent->_instructions[i];
+		const SQInstruction &closure = parent->_instructions[i + 1];
+		if (load.op == _OP_LOAD && load._arg1 == literal && closure.op == _OP_CLOSURE && closure._arg1 == ref.index) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// keeps the signature so that existing calls still succeed, but the body only returns null
+static SQFunctionProto *make_stub_proto(SQSharedState *ss, const SQFunctionProto *func) {
+	SQFunctionProto *stub = SQFunctionProto::Create(ss, 1, 0, func->_nparameters, 0, 0, func->_nlineinfos > 0 ? 1 : 0, 0, func->_ndefaultparams);
+	stub->_sourcename = func->_sourcename;
+	stub->_name = func->_name;
+	stub->_stacksize = func->_nparameters;
+	stub->_bgenerator = func->_bgenerator;
+	stub->_varparams = func->_varparams;
+
+	for (SQInteger i = 0; i < func->_nparameters; i++) {
+		stub->_parameters[i] = func->_parameters[i];
+	}
+	for (SQInteger i = 0; i < func->_ndefaultparams; i++) {
+		stub->_defaultparams[i] = func->_defaultparams[i];
+	}
+	if (func->_nlineinfos > 0) {
+		stub->_lineinfos[0] = func->_lineinfos[0];
+		stub->_lineinfos[0]._op = 0;
+	}
+
+	stub->_instructions[0] = SQInstruction(_OP_RETURN, 0xFF);
+
+	return stub;
+}
+
+SQRESULT godot_squirrel_eliminate_dead_functions(HSQUIRRELVM vm, SQInteger first_idx, SQInteger count, SQInteger keep_idx, void (*on_removed)(void *userdata, SQInteger closure, const SQChar *name, SQInteger line, SQInteger instructions), void *userdata) {
+	HSQOBJECT keep_obj;
+	if (SQ_FAILED(sq_getstackobj(vm, keep_idx, &keep_obj)) || !sq_istable(keep_obj)) {
+		return sq_throwerror(vm, _SC("expected a table of names to keep"));
+	}
+	SQTable *keep = keep_obj._unVal.pTable;
+
+	sqvector<SQFunctionProto *> roots;
+	for (SQInteger i = 0; i < count; i++) {
+		HSQOBJECT obj;
+		if (SQ_FAILED(sq_getstackobj(vm, first_idx + i, &obj)) || !sq_isclosure(obj)) {
+			return sq_throwerror(vm, _SC("expected a closure"));
+		}
+		roots.push_back(obj._unVal.pClosure->_function);
+	}
+
+	sqvector<ProtoRef> protos;
+	sqvector<SQInteger> owners;
+	for (SQUnsignedInteger i = 0; i < roots.size(); i++) {
+		const SQUnsignedInteger start = protos.size();
+		collect_protos(roots[i], nullptr, -1, protos);
+		for (SQUnsignedInteger j = start; j < protos.size(); j++) {
+			owners.push_back(SQInteger(i));
+		}
+	}
+
+	// the number of functions that contain each string literal
+	SQObjectPtr presence_obj(SQTable::Create(_ss(vm), 0));
+	SQTable *presence = _table(presence_obj);
+	for (SQUnsignedInteger i = 0; i < protos.size(); i++) {
+		const SQFunctionProto *func = protos[i].func;
+		for (SQInteger j = 0; j < func->_nliterals; j++) {
+			if (sq_type(func->_literals[j]) != OT_STRING) {
+				continue;
+			}
+			SQObjectPtr value;
+			if (presence->Get(func->_literals[j], value)) {
+				presence->Set(func->_literals[j], SQObjectPtr(_integer(value) + 1));
+			} else {
+				presence->NewSlot(func->_literals[j], SQObjectPtr(SQInteger(1)));
+			}
+		}
+	}
+
+	// functions chained by name, so the ones affected by a literal disappearing can be found
+	SQObjectPtr by_name_obj(SQTable::Create(_ss(vm), 0));
+	SQTable *by_name = _table(by_name_obj);
+	for (SQUnsignedInteger i = 0; i < protos.size(); i++) {
+		const SQObjectPtr &name = protos[i].func->_name;
+		if (sq_type(name) != OT_STRING) {
+			continue;
+		}
+		SQObjectPtr first;
+		if (by_name->Get(name, first)) {
+			protos[i].next_same_name = _integer(first);
+			by_name->Set(name, SQObjectPtr(SQInteger(i)));
+		} else {
+			by_name->NewSlot(name, SQObjectPtr(SQInteger(i)));
+		}
+	}
+
+	// removing a function drops its literals, which can make the functions they
+	// named dead in turn. only those are checked again.
+	sqvector<SQInteger> pending;
+	for (SQInteger i = SQInteger(protos.size()) - 1; i >= 0; i--) {
+		pending.push_back(i);
+	}
+	while (!pending.empty()) {
+		const SQInteger i = pending.back();
+		pending.pop_back();
+
+		const ProtoRef &ref = protos[i];
+		if (ref.removed || !is_dead_function(ref, presence, keep)) {
+			continue;
+		}
+
+		if (on_removed) {
+			const SQInteger line = ref.func->_nlineinfos > 0 ? ref.func->_lineinfos[0]._line : 0;
+			on_removed(userdata, owners[i], _stringval(ref.func->_name), line, count_instructions(ref.func) - 1);
+		}
+
+		// the whole subtree goes away, so its literals no longer count. this must
+		// happen before the replacement below frees the protos.
+		for (SQInteger j = i; j < ref.end; j++) {
+			protos[j].removed = true;
+			const SQFunctionProto *func = protos[j].func;
+			for (SQInteger k = 0; k < func->_nliterals; k++) {
+				SQObjectPtr value;
+				if (sq_type(func->_literals[k]) != OT_STRING || !presence->Get(func->_literals[k], value)) {
+					continue;
+				}
+				presence->Set(func->_literals[k], SQObjectPtr(_integer(value) - 1));
+
+				SQObjectPtr first;
+				if (_integer(value) - 1 == 1 && by_name->Get(func->_literals[k], first)) {
+					for (SQInteger other = _integer(first); other >= 0; other = protos[other].next_same_name) {
+						pending.push_back(other);
+					}
+				}
+			}
+		}
+
+		ref.parent->_functions[ref.index] = SQObjectPtr(make_stub_proto(_ss(vm), ref.func));
+	}
+
+	return SQ_OK;
+}
+
+static void count_proto_statistics(const SQFunctionProto *func, SQInteger &functions, SQInteger &instructions, SQInteger &literals) {
+	functions++;
+	instructions += func->_ninstructions;
+	literals += func->_nliterals;
+
+	for (SQInteger i = 0; i < func->_nfunctions; i++) {
+		count_proto_statistics(_funcproto(func->_functions[i]), functions, instructions, literals);
+	}
+}
+
+SQRESULT godot_squirrel_get_closure_statistics(HSQUIRRELVM vm, SQInteger idx, SQInteger *functions, SQInteger *instructions, SQInteger *literals) {
+	HSQOBJECT obj;
+	if (SQ_FAILED(sq_getstackobj(vm, idx, &obj)) || !sq_isclosure(obj)) {
+		return sq_throwerror(vm, _SC("expected a closure"));
+	}
+
+	SQInteger function_count = 0;
+	SQInteger instruction_count = 0;
+	SQInteger literal_count = 0;
+	count_proto_statistics(obj._unVal.pClosure->_function, function_count, instruction_count, literal_count);
+
+	if (functions) {
+		*functions = function_count;
+	}
+	if (instructions) {
+		*instructions = instruction_count;
+	}
+	if (literals) {
+		*literals = literal_count;
+	}
+
+	return SQ_OK;
+}
+
+namespace {
+struct ProtoBuffer {
+	sqvector<unsigned char> data;
+	SQUnsignedInteger offset = 0;
+
+	static SQInteger write(SQUserPointer p_buffer, SQUserPointer p_data, SQInteger p_size) {
+		ProtoBuffer *buffer = reinterpret_cast<ProtoBuffer *>(p_buffer);
+		const SQUnsignedInteger start = buffer->data.size();
+		const SQUnsignedInteger required = start + SQUnsignedInteger(p_size);
+		if (required > buffer->data.capacity()) {
+			buffer->data.reserve(required > buffer->data.capacity() * 2 ? required : buffer->data.capacity() * 2);
+		}
+		buffer->data.resize(required);
+		memcpy(&buffer->data[start], p_data, p_size);
+		return p_size;
+	}
+
+	static SQInteger read(SQUserPointer p_buffer, SQUserPointer p_data, SQInteger p_size) {
+		ProtoBuffer *buffer = reinterpret_cast<ProtoBuffer *>(p_buffer);
+		const SQUnsignedInteger remaining = buffer->data.size() - buffer->offset;
+		const SQUnsignedInteger count = SQUnsignedInteger(p_size) < remaining ? SQUnsignedInteger(p_size) : remaining;
+		memcpy(p_data, &buffer->data[buffer->offset], count);
+		buffer->offset += count;
+		return SQInteger(count);
+	}
+};
+
+struct PendingCopy {
+	SQObjectPtr from;
+	SQObjectPtr to;
+};
+
+// copies objects from one VM's heap into another. reference types are first
+// created empty and filled in later, so deep structures don't recurse.
+struct HeapCopier {
+	SQVM *src = nullptr;
+	SQVM *dst = nullptr;
+	SQBool (*copy_userdata)(HSQUIRRELVM src, HSQUIRRELVM dst, const HSQOBJECT *obj) = nullptr;
+
+	SQObjectPtr copies; // table in the destination VM: source object -> copied object
+	sqvector<PendingCopy> pending;
+	const SQChar *error = nullptr;
+
+	bool fail(const SQChar *message) {
+		if (error == nullptr) {
+			error = message;
+		}
+		return false;
+	}
+
+	void map(const SQObjectPtr &from, const SQObjectPtr &to, bool fill) {
+		_table(copies)->NewSlot(from, to);
+		if (fill) {
+			PendingCopy copy;
+			copy.from = from;
+			copy.to = to;
+			pending.push_back(copy);
+		}
+	}
+
+	void map_protos(SQFunctionProto *from, SQFunctionProto *to) {
+		_table(copies)->NewSlot(SQObjectPtr(from), SQObjectPtr(to));
+		for (SQInteger i = 0; i < from->_nfunctions && i < to->_nfunctions; i++) {
+			map_protos(_funcproto(from->_functions[i]), _funcproto(to->_functions[i]));
+		}
+	}
+
+	bool copy_proto(SQFunctionProto *from, SQObjectPtr &to) {
+		if (_table(copies)->Get(SQObjectPtr(from), to)) {
+			return true;
+		}
+
+		ProtoBuffer buffer;
+		if (!from->Save(src, &buffer, &ProtoBuffer::write) || !SQFunctionProto::Load(dst, &buffer, &ProtoBuffer::read, to)) {
+			return fail(_SC("could not copy a function prototype"));
+		}
+
+		map_protos(from, _funcproto(to));
+		return true;
+	}
+
+	bool copy_weak_ref(SQWeakRef *from, SQWeakRef *&to) {
+		to = nullptr;
+		if (from == nullptr || sq_type(from->_obj) == OT_NULL) {
+			return true;
+		}
+
+		SQObjectPtr target;
+		if (!copy(SQObjectPtr(from->_obj), target)) {
+			return false;
+		}
+		if (ISREFCOUNTED(sq_type(target))) {
+			to = target._unVal.pRefCounted->GetWeakRef(sq_type(target));
+		}
+		return true;
+	}
+
+	bool copy_class(SQClass *from, SQObjectPtr &to) {
+		SQObjectPtr base;
+		if (from->_base && !copy(SQObjectPtr(from->_base), base)) {
+			return false;
+		}
+
+		SQClass *cls = SQClass::Create(_ss(dst), from->_base ? _class(base) : nullptr);
+		to = SQObjectPtr(cls);
+		map(SQObjectPtr(from), to, false);
+
+		// derived classes copy their base's members on creation, so classes are filled right away
+		SQInteger ridx = 0;
+		SQObjectPtr key, value, key_copy;
+		while ((ridx = from->_members->Next(true, SQObjectPtr(ridx), key, value)) != -1) {
+			if (!copy(key, key_copy)) {
+				return false;
+			}
+			// member values are indices into _methods or _defaultvalues
+			cls->_members->NewSlot(key_copy, value);
+		}
+
+		cls->_methods.resize(from->_methods.size());
+		for (SQUnsignedInteger i = 0; i < from->_methods.size(); i++) {
+			if (!copy(from->_methods[i].val, cls->_methods[i].val) || !copy(from->_methods[i].attrs, cls->_methods[i].attrs)) {
+				return false;
+			}
+		}
+		cls->_defaultvalues.resize(from->_defaultvalues.size());
+		for (SQUnsignedInteger i = 0; i < from->_defaultvalues.size(); i++) {
+			if (!copy(from->_defaultvalues[i].val, cls->_defaultvalues[i].val) || !copy(from->_defaultvalues[i].attrs, cls->_defaultvalues[i].attrs)) {
+				return false;
+			}
+		}
+		for (SQInteger i = 0; i < MT_LAST; i++) {
+			if (!copy(from->_metamethods[i], cls->_metamethods[i])) {
+				return false;
+			}
+		}
+		if (!copy(from->_attributes, cls->_attributes)) {
+			return false;
+		}
+
+		cls->_typetag = from->_typetag;
+		cls->_hook = from->_hook;
+		cls->_locked = from->_locked;
+		cls->_constructoridx = from->_constructoridx;
+		cls->_udsize = from->_udsize;
+
+		return true;
+	}
+
+	bool copy(const SQObjectPtr &from, SQObjectPtr &to) {
+		switch (sq_type(from)) {
+			case OT_NULL:
+			case OT_INTEGER:
+			case OT_FLOAT:
+			case OT_BOOL:
+			case OT_USERPOINTER:
+				to = from;
+				return true;
+			case OT_STRING:
+				to = SQString::Create(_ss(dst), _stringval(from), _string(from)->_len);
+				return true;
+			default:
+				break;
+		}
+
+		if (_table(copies)->Get(from, to)) {
+			return true;
+		}
+
+		switch (sq_type(from)) {
+			case OT_TABLE:
+				to = SQTable::Create(_ss(dst), _table(from)->CountUsed());
+				map(from, to, true);
+				return true;
+			case OT_ARRAY:
+				to = SQArray::Create(_ss(dst), _array(from)->Size());
+				map(from, to, true);
+				return true;
+			case OT_CLOSURE: {
+				SQClosure *closure = _closure(from);
+				SQObjectPtr proto;
+				SQWeakRef *root = nullptr;
+				if (!copy_proto(closure->_function, proto) || !copy_weak_ref(closure->_root, root)) {
+					return false;
+				}
+				if (root == nullptr) {
+					root = _table(dst->_roottable)->GetWeakRef(OT_TABLE);
+				}
+				to = SQClosure::Create(_ss(dst), _funcproto(proto), root);
+				map(from, to, true);
+				return true;
+			}
+			case OT_NATIVECLOSURE: {
+				SQNativeClosure *closure = _nativeclosure(from);
+				to = SQNativeClosure::Create(_ss(dst), closure->_function, closure->_noutervalues);
+				map(from, to, true);
+				return true;
+			}
+			case OT_OUTER:
+				if (_outer(from)->_valptr != &_outer(from)->_value) {
+					return fail(_SC("cannot copy a free variable of a function that is still running"));
+				}
+				to = SQObjectPtr(SQOuter::Create(_ss(dst), nullptr));
+				_outer(to)->_valptr = &_outer(to)->_value;
+				map(from, to, true);
+				return true;
+			case OT_CLASS:
+				return copy_class(_class(from), to);
+			case OT_INSTANCE: {
+				SQInstance *instance = _instance(from);
+				if (instance->_userpointer != nullptr) {
+					return fail(_SC("cannot copy an instance with native data"));
+				}
+				SQObjectPtr cls;
+				if (!copy(SQObjectPtr(instance->_class), cls)) {
+					return false;
+				}
+				to = SQInstance::Create(_ss(dst), _class(cls));
+				map(from, to, true);
+				return true;
+			}
+			case OT_WEAKREF: {
+				SQWeakRef *weak_ref = nullptr;
+				if (!copy_weak_ref(_weakref(from), weak_ref)) {
+					return false;
+				}
+				to = weak_ref ? SQObjectPtr(weak_ref) : SQObjectPtr();
+				return true;
+			}
+			case OT_FUNCPROTO:
+				return copy_proto(_funcproto(from), to);
+			case OT_USERDATA: {
+				if (copy_userdata == nullptr || !copy_userdata(src, dst, &from)) {
+					return fail(_SC("cannot copy userdata"));
+				}
+				to = dst->Top();
+				dst->Pop();
+				map(from, to, false);
+				return true;
+			}
+			case OT_GENERATOR:
+				return fail(_SC("cannot copy a generator"));
+			case OT_THREAD:
+				return fail(_SC("cannot copy a thread"));
+			default:
+				return fail(_SC("cannot copy an object of unknown type"));
+		}
+	}
+
+	bool fill_table(SQTable *from, SQTable *to) {
+		SQObjectPtr delegate;
+		if (from->_delegate) {
+			if (!copy(SQObjectPtr(from->_delegate), delegate)) {
+				return false;
+			}
+			to->SetDelegate(_table(delegate));
+		}
+
+		SQInteger ridx = 0;
+		SQObjectPtr key, value, key_copy, value_copy;
+		while ((ridx = from->Next(true, SQObjectPtr(ridx), key, value)) != -1) {
+			if (!copy(key, key_copy) || !copy(value, value_copy)) {
+				return false;
+			}
+			to->NewSlot(key_copy, value_copy);
+		}
+		return true;
+	}
+
+	bool fill(const SQObjectPtr &from, const SQObjectPtr &to) {
+		switch (sq_type(from)) {
+			case OT_TABLE:
+				return fill_table(_table(from), _table(to));
+			case OT_ARRAY: {
+				SQArray *array = _array(from);
+				for (SQInteger i = 0; i < array->Size(); i++) {
+					if (!copy(array->_values[i], _array(to)->_values[i])) {
+						return false;
+					}
+				}
+				return true;
+			}
+			case OT_CLOSURE: {
+				SQClosure *closure = _closure(from);
+				SQClosure *copy_closure = _closure(to);
+				for (SQInteger i = 0; i < closure->_function->_noutervalues; i++) {
+					if (!copy(closure->_outervalues[i], copy_closure->_outervalues[i])) {
+						return false;
+					}
+				}
+				for (SQInteger i = 0; i < closure->_function->_ndefaultparams; i++) {
+					if (!copy(closure->_defaultparams[i], copy_closure->_defaultparams[i])) {
+						return false;
+					}
+				}
+				if (!copy_weak_ref(closure->_env, copy_closure->_env)) {
+					return false;
+				}
+				if (copy_closure->_env) {
+					__ObjAddRef(copy_closure->_env);
+				}
+				if (closure->_base) {
+					SQObjectPtr base;
+					if (!copy(SQObjectPtr(closure->_base), base)) {
+						return false;
+					}
+					copy_closure->_base = _class(base);
+					__ObjAddRef(copy_closure->_base);
+				}
+				return true;
+			}
+			case OT_NATIVECLOSURE: {
+				SQNativeClosure *closure = _nativeclosure(from);
+				SQNativeClosure *copy_closure = _nativeclosure(to);
+				for (SQUnsignedInteger i = 0; i < closure->_noutervalues; i++) {
+					if (!copy(closure->_outervalues[i], copy_closure->_outervalues[i])) {
+						return false;
+					}
+				}
+				copy_closure->_typecheck.copy(closure->_typecheck);
+				copy_closure->_nparamscheck = closure->_nparamscheck;
+				if (!copy(closure->_name, copy_closure->_name) || !copy_weak_ref(closure->_env, copy_closure->_env)) {
+					return false;
+				}
+				if (copy_closure->_env) {
+					__ObjAddRef(copy_closure->_env);
+				}
+				return true;
+			}
+			case OT_OUTER:
+				return copy(_outer(from)->_value, _outer(to)->_value);
+			case OT_INSTANCE: {
+				SQInstance *instance = _instance(from);
+				const SQUnsignedInteger count = instance->_class->_defaultvalues.size();
+				for (SQUnsignedInteger i = 0; i < count; i++) {
+					if (!copy(instance->_values[i], _instance(to)->_values[i])) {
+						return false;
+					}
+				}
+				return true;
+			}
+			default:
+				return true;
+		}
+	}
+
+	bool run() {
+		while (!pending.empty()) {
+			const PendingCopy next = pending.top();
+			pending.pop_back();
+			if (!fill(next.from, next.to)) {
+				return false;
+			}
+		}
+		return true;
+	}
+};
+} //namespace
+
+SQRESULT godot_squirrel_copy_heap(HSQUIRRELVM src, HSQUIRRELVM dst, SQBool (*copy_userdata)(HSQUIRRELVM src, HSQUIRRELVM dst, const HSQOBJECT *obj)) {
+	if (sq_getvmstate(src) != SQ_VMSTATE_IDLE || src->_callsstacksize != 0) {
+		return sq_throwerror(dst, _SC("cannot copy a VM that is running"));
+	}
+
+	HeapCopier copier;
+	copier.src = src;
+	copier.dst = dst;
+	copier.copy_userdata = copy_userdata;
+	// the bookkeeping belongs to the new VM, like everything else it allocates
+	copier.copies = SQTable::Create(_ss(dst), 0);
+
+	SQSharedState *from = _ss(src);
+	SQSharedState *to = _ss(dst);
+
+	// the tables every VM starts with are replaced in place rather than copied,
+	// so native code holding references to them in the new VM stays valid.
+	const SQObjectPtr *const roots[][2] = {
+		{ &src->_roottable, &dst->_roottable },
+		{ &from->_consts, &to->_consts },
+		{ &from->_registry, &to->_registry },
+		{ &from->_table_default_delegate, &to->_table_default_delegate },
+		{ &from->_array_default_delegate, &to->_array_default_delegate },
+		{ &from->_string_default_delegate, &to->_string_default_delegate },
+		{ &from->_number_default_delegate, &to->_number_default_delegate },
+		{ &from->_generator_default_delegate, &to->_generator_default_delegate },
+		{ &from->_closure_default_delegate, &to->_closure_default_delegate },
+		{ &from->_thread_default_delegate, &to->_thread_default_delegate },
+		{ &from->_class_default_delegate, &to->_class_default_delegate },
+		{ &from->_instance_default_delegate, &to->_instance_default_delegate },
+		{ &from->_weakref_default_delegate, &to->_weakref_default_delegate },
+	};
+	for (const auto &root : roots) {
+		if (sq_type(*root[0]) != OT_TABLE || sq_type(*root[1]) != OT_TABLE) {
+			continue;
+		}
+		_table(*root[1])->Clear();
+		copier.map(*root[0], *root[1], true);
+	}
+
+	dst->_notifyallexceptions = src->_notifyallexceptions;
+	const bool ok = copier.copy(src->_errorhandler, dst->_errorhandler) && copier.run();
+
+	// drop the mapping before anything else can observe objects from both VMs
+	copier.copies.Null();
+
+	if (!ok) {
+		return sq_throwerror(dst, copier.error ? copier.error : _SC("could not copy the heap"));
+	}
+
+	return SQ_OK;
+}
+
+// heap images: every object reachable from the root tables is given an id.
+// objects are created first, then filled in, so references can point anywhere.
+// native closures and native classes cannot be serialized; instead, the path of
+// keys leading to them from a root table is stored and looked up on load.
+#define SQUIRREL_IMAGE_MAGIC 0x4D495153 // "SQIM"
+#define SQUIRREL_IMAGE_VERSION 2
+
+enum ImageValueTag : unsigned char {
+	IMAGE_NULL,
+	IMAGE_INTEGER,
+	IMAGE_FLOAT,
+	IMAGE_BOOL,
+	IMAGE_STRING,
+	IMAGE_REF,
+	IMAGE_WEAKREF,
+};
+
+enum ImageRecordType : unsigned char {
+	IMAGE_TABLE,
+	IMAGE_ARRAY,
+	IMAGE_PROTO,
+	IMAGE_CLOSURE,
+	IMAGE_NATIVE,
+	IMAGE_OUTER,
+	IMAGE_CLASS,
+	IMAGE_INSTANCE,
+	IMAGE_USERDATA,
+};
+
+static const SQInteger IMAGE_NO_PATH = -2;
+static const SQInteger IMAGE_ROOT = -1;
+
+static bool is_native_class(const SQClass *cls) {
+	return cls->_typetag != nullptr || cls->_hook != nullptr || cls->_udsize != 0;
+}
+
+static void get_image_roots(SQVM *vm, SQObjectPtr *roots[]) {
+	SQSharedState *ss = _ss(vm);
+	roots[0] = &vm->_roottable;
+	roots[1] = &ss->_consts;
+	roots[2] = &ss->_registry;
+	roots[3] = &ss->_table_default_delegate;
+	roots[4] = &ss->_array_default_delegate;
+	roots[5] = &ss->_string_default_delegate;
+	roots[6] = &ss->_number_default_delegate;
+	roots[7] = &ss->_generator_default_delegate;
+	roots[8] = &ss->_closure_default_delegate;
+	roots[9] = &ss->_thread_default_delegate;
+	roots[10] = &ss->_class_default_delegate;
+	roots[11] = &ss->_instance_default_delegate;
+	roots[12] = &ss->_weakref_default_delegate;
+}
+#define IMAGE_ROOT_COUNT 13
+
+namespace {
+struct ImageObject {
+	SQObjectPtr obj;
+	SQInteger parent;
+	SQObjectPtr key;
+};
+
+struct ImageWriter {
+	SQVM *vm = nullptr;
+	SQWRITEFUNC write_func = nullptr;
+	SQUserPointer up = nullptr;
+	SQRESULT (*write_userdata)(HSQUIRRELVM vm, const HSQOBJECT *obj, SQWRITEFUNC write, SQUserPointer up) = nullptr;
+
+	sqvector<ImageObject> objects;
+	SQObjectPtr ids; // table: object -> id
+	const SQChar *error = nullptr;
+
+	bool fail(const SQChar *message) {
+		if (error == nullptr) {
+			error = message;
+		}
+		return false;
+	}
+
+	bool write(const void *data, SQInteger size) {
+		return write_func(up, const_cast<void *>(data), size) == size || fail(_SC("could not write the image"));
+	}
+
+	template <typename T>
+	bool write_raw(T value) {
+		return write(&value, sizeof(T));
+	}
+
+	bool is_native(const SQObjectPtr &obj) const {
+		return sq_type(obj) == OT_NATIVECLOSURE || (sq_type(obj) == OT_CLASS && is_native_class(_class(obj)));
+	}
+
+	bool has_path(SQInteger id) const {
+		return objects[id].parent != IMAGE_NO_PATH;
+	}
+
+	// assigns an id to a reference type; the first path found to a native is kept
+	void discover(const SQObjectPtr &obj, SQInteger parent, const SQObjectPtr &key) {
+		switch (sq_type(obj)) {
+			case OT_TABLE:
+			case OT_ARRAY:
+			case OT_CLOSURE:
+			case OT_NATIVECLOSURE:
+			case OT_OUTER:
+			case OT_CLASS:
+			case OT_INSTANCE:
+			case OT_USERDATA:
+			case OT_FUNCPROTO:
+			case OT_GENERATOR:
+			case OT_THREAD:
+				break;
+			case OT_WEAKREF:
+				if (sq_type(_weakref(obj)->_obj) != OT_NULL) {
+					discover(SQObjectPtr(_weakref(obj)->_obj), IMAGE_NO_PATH, SQObjectPtr());
+				}
+				return;
+			default:
+				return;
+		}
+
+		const bool keyed = parent >= 0 && has_path(parent) && sq_type(key) == OT_STRING;
+
+		SQObjectPtr id;
+		if (_table(ids)->Get(obj, id)) {
+			ImageObject &existing = objects[_integer(id)];
+			if (existing.parent == IMAGE_NO_PATH && keyed) {
+				existing.parent = parent;
+				existing.key = key;
+			}
+			return;
+		}
+
+		// classes are created in id order, so bases need lower ids
+		if (sq_type(obj) == OT_CLASS && !is_native_class(_class(obj)) && _class(obj)->_base) {
+			discover(SQObjectPtr(_class(obj)->_base), IMAGE_NO_PATH, SQObjectPtr());
+		}
+		if (sq_type(obj) == OT_CLOSURE) {
+			discover(SQObjectPtr(_closure(obj)->_function), IMAGE_NO_PATH, SQObjectPtr());
+		}
+
+		ImageObject entry;
+		entry.obj = obj;
+		entry.parent = keyed ? parent : IMAGE_NO_PATH;
+		entry.key = keyed ? key : SQObjectPtr();
+		_table(ids)->NewSlot(obj, SQObjectPtr(SQInteger(objects.size())));
+		objects.push_back(entry);
+	}
+
+	void visit(SQInteger id) {
+		const SQObjectPtr obj = objects[id].obj;
+		const SQObjectPtr none;
+		switch (sq_type(obj)) {
+			case OT_TABLE: {
+				SQTable *table = _table(obj);
+				if (table->_delegate) {
+					discover(SQObjectPtr(table->_delegate), IMAGE_NO_PATH, none);
+				}
+				SQInteger ridx = 0;
+				SQObjectPtr key, value;
+				while ((ridx = table->Next(true, SQObjectPtr(ridx), key, value)) != -1) {
+					discover(key, IMAGE_NO_PATH, none);
+					discover(value, id, key);
+				}
+				break;
+			}
+			case OT_ARRAY: {
+				SQArray *array = _array(obj);
+				for (SQInteger i = 0; i < array->Size(); i++) {
+					discover(array->_values[i], IMAGE_NO_PATH, none);
+				}
+				break;
+			}
+			case OT_CLOSURE: {
+				SQClosure *closure = _closure(obj);
+				for (SQInteger i = 0; i < closure->_function->_noutervalues; i++) {
+					discover(closure->_outervalues[i], IMAGE_NO_PATH, none);
+				}
+				for (SQInteger i = 0; i < closure->_function->_ndefaultparams; i++) {
+					discover(closure->_defaultparams[i], IMAGE_NO_PATH, none);
+				}
+				if (closure->_env && sq_type(closure->_env->_obj) != OT_NULL) {
+					discover(SQObjectPtr(closure->_env->_obj), IMAGE_NO_PATH, none);
+				}
+				if (closure->_base) {
+					discover(SQObjectPtr(closure->_base), IMAGE_NO_PATH, none);
+				}
+				break;
+			}
+			case OT_OUTER:
+				discover(_outer(obj)->_value, IMAGE_NO_PATH, none);
+				break;
+			case OT_CLASS: {
+				SQClass *cls = _class(obj);
+				if (is_native_class(cls)) {
+					break;
+				}
+				SQInteger ridx = 0;
+				SQObjectPtr key, value;
+				while ((ridx = cls->_members->Next(true, SQObjectPtr(ridx), key, value)) != -1) {
+					SQObjectPtr member;
+					cls->Get(key, member);
+					discover(member, id, key);
+				}
+				for (SQUnsignedInteger i = 0; i < cls->_methods.size(); i++) {
+					discover(cls->_methods[i].val, IMAGE_NO_PATH, none);
+					discover(cls->_methods[i].attrs, IMAGE_NO_PATH, none);
+				}
+				for (SQUnsignedInteger i = 0; i < cls->_defaultvalues.size(); i++) {
+					discover(cls->_defaultvalues[i].val, IMAGE_NO_PATH, none);
+					discover(cls->_defaultvalues[i].attrs, IMAGE_NO_PATH, none);
+				}
+				for (SQInteger i = 0; i < MT_LAST; i++) {
+					discover(cls->_metamethods[i], IMAGE_NO_PATH, none);
+				}
+				discover(cls->_attributes, IMAGE_NO_PATH, none);
+				break;
+			}
+			case OT_INSTANCE: {
+				SQInstance *instance = _instance(obj);
+				discover(SQObjectPtr(instance->_class), IMAGE_NO_PATH, none);
+				for (SQUnsignedInteger i = 0; i < instance->_class->_defaultvalues.size(); i++) {
+					discover(instance->_values[i], IMAGE_NO_PATH, none);
+				}
+				break;
+			}
+			default:
+				break;
+		}
+	}
+
+	bool write_value(const SQObjectPtr &value) {
+		switch (sq_type(value)) {
+			case OT_NULL:
+				return write_raw<unsigned char>(IMAGE_NULL);
+			case OT_INTEGER:
+				return write_raw<unsigned char>(IMAGE_INTEGER) && write_raw<SQInteger>(_integer(value));
+			case OT_FLOAT:
+				return write_raw<unsigned char>(IMAGE_FLOAT) && write_raw<SQFloat>(_float(value));
+			case OT_BOOL:
+				return write_raw<unsigned char>(IMAGE_BOOL) && write_raw<unsigned char>(_integer(value) ? 1 : 0);
+			case OT_STRING:
+				return write_raw<unsigned char>(IMAGE_STRING) && write_raw<SQInteger>(_string(value)->_len) && write(_stringval(value), _string(value)->_len * sizeof(SQChar));
+			case OT_WEAKREF: {
+				SQObjectPtr id;
+				if (sq_type(_weakref(value)->_obj) == OT_NULL || !_table(ids)->Get(SQObjectPtr(_weakref(value)->_obj), id)) {
+					return write_raw<unsigned char>(IMAGE_NULL);
+				}
+				return write_raw<unsigned char>(IMAGE_WEAKREF) && write_raw<SQInteger>(_integer(id));
+			}
+			case OT_USERPOINTER:
+				return fail(_SC("cannot save a userpointer"));
+			default: {
+				SQObjectPtr id;
+				if (!_table(ids)->Get(value, id)) {
+					return fail(_SC("object missing from image"));
+				}
+				return write_raw<unsigned char>(IMAGE_REF) && write_raw<SQInteger>(_integer(id));
+			}
+		}
+	}
+
+	bool write_path(SQInteger id) {
+		sqvector<SQInteger> chain;
+		for (SQInteger current = id; current >= IMAGE_ROOT_COUNT; current = objects[current].parent) {
+			chain.push_back(current);
+		}
+		const SQInteger root = chain.empty() ? id : objects[chain.top()].parent;
+		if (!write_raw<SQInteger>(root) || !write_raw<SQInteger>(SQInteger(chain.size()))) {
+			return false;
+		}
+		for (SQInteger i = SQInteger(chain.size()) - 1; i >= 0; i--) {
+			if (!write_value(objects[chain[i]].key)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool write_creation(SQInteger id) {
+		const SQObjectPtr &obj = objects[id].obj;
+		if (!write_raw<SQInteger>(id)) {
+			return false;
+		}
+
+		if (is_native(obj)) {
+			if (!has_path(id)) {
+				return fail(_SC("cannot save a native function or class that is not stored under a name in a table"));
+			}
+			const SQObjectPtr name = sq_type(obj) == OT_NATIVECLOSURE && sq_type(_nativeclosure(obj)->_name) == OT_STRING ? _nativeclosure(obj)->_name : objects[id].key;
+			return write_raw<unsigned char>(IMAGE_NATIVE) && write_value(name) && write_path(id);
+		}
+
+		switch (sq_type(obj)) {
+			case OT_TABLE:
+				return write_raw<unsigned char>(IMAGE_TABLE) && write_raw<SQInteger>(_table(obj)->CountUsed());
+			case OT_ARRAY:
+				return write_raw<unsigned char>(IMAGE_ARRAY) && write_raw<SQInteger>(_array(obj)->Size());
+			case OT_FUNCPROTO: {
+				ProtoBuffer buffer;
+				if (!_funcproto(obj)->Save(vm, &buffer, &ProtoBuffer::write)) {
+					return fail(_SC("could not save a function prototype"));
+				}
+				return write_raw<unsigned char>(IMAGE_PROTO) && write_raw<SQInteger>(SQInteger(buffer.data.size())) && write(buffer.data.size() ? &buffer.data[0] : nullptr, SQInteger(buffer.data.size()));
+			}
+			case OT_CLOSURE:
+				return write_raw<unsigned char>(IMAGE_CLOSURE) && write_value(SQObjectPtr(_closure(obj)->_function));
+			case OT_OUTER:
+				if (_outer(obj)->_valptr != &_outer(obj)->_value) {
+					return fail(_SC("cannot save a free variable of a function that is still running"));
+				}
+				return write_raw<unsigned char>(IMAGE_OUTER);
+			case OT_CLASS:
+				return write_raw<unsigned char>(IMAGE_CLASS) && write_value(_class(obj)->_base ? SQObjectPtr(_class(obj)->_base) : SQObjectPtr());
+			case OT_INSTANCE:
+				if (_instance(obj)->_userpointer != nullptr) {
+					return fail(_SC("cannot save an instance with native data"));
+				}
+				return write_raw<unsigned char>(IMAGE_INSTANCE) && write_value(SQObjectPtr(_instance(obj)->_class));
+			case OT_USERDATA:
+				if (write_userdata == nullptr || !write_raw<unsigned char>(IMAGE_USERDATA)) {
+					return fail(_SC("cannot save userdata"));
+				}
+				if (SQ_FAILED(write_userdata(vm, &obj, write_func, up))) {
+					return fail(_SC("cannot save userdata"));
+				}
+				return true;
+			case OT_GENERATOR:
+				return fail(_SC("cannot save a generator"));
+			case OT_THREAD:
+				return fail(_SC("cannot save a thread"));
+			default:
+				return fail(_SC("cannot save an object of unknown type"));
+		}
+	}
+
+	bool write_fill(SQInteger id) {
+		const SQObjectPtr &obj = objects[id].obj;
+		if (!write_raw<SQInteger>(id)) {
+			return false;
+		}
+
+		switch (sq_type(obj)) {
+			case OT_TABLE: {
+				SQTable *table = _table(obj);
+				if (!write_value(table->_delegate ? SQObjectPtr(table->_delegate) : SQObjectPtr()) || !write_raw<SQInteger>(table->CountUsed())) {
+					return false;
+				}
+				SQInteger ridx = 0;
+				SQObjectPtr key, value;
+				while ((ridx = table->Next(true, SQObjectPtr(ridx), key, value)) != -1) {
+					if (!write_value(key) || !write_value(value)) {
+						return false;
+					}
+				}
+				return true;
+			}
+			case OT_ARRAY: {
+				SQArray *array = _array(obj);
+				for (SQInteger i = 0; i < array->Size(); i++) {
+					if (!write_value(array->_values[i])) {
+						return false;
+					}
+				}
+				return true;
+			}
+			case OT_CLOSURE: {
+				SQClosure *closure = _closure(obj);
+				for (SQInteger i = 0; i < closure->_function->_noutervalues; i++) {
+					if (!write_value(closure->_outervalues[i])) {
+						return false;
+					}
+				}
+				for (SQInteger i = 0; i < closure->_function->_ndefaultparams; i++) {
+					if (!write_value(closure->_defaultparams[i])) {
+						return false;
+					}
+				}
+				const SQObjectPtr env = closure->_env ? SQObjectPtr(closure->_env->_obj) : SQObjectPtr();
+				return write_value(env) && write_value(closure->_base ? SQObjectPtr(closure->_base) : SQObjectPtr());
+			}
+			case OT_OUTER:
+				return write_value(_outer(obj)->_value);
+			case OT_CLASS: {
+				SQClass *cls = _class(obj);
+				if (!write_raw<SQInteger>(cls->_members->CountUsed())) {
+					return false;
+				}
+				SQInteger ridx = 0;
+				SQObjectPtr key, value;
+				while ((ridx = cls->_members->Next(true, SQObjectPtr(ridx), key, value)) != -1) {
+					if (!write_value(key) || !write_value(value)) {
+						return false;
+					}
+				}
+				if (!write_raw<SQInteger>(SQInteger(cls->_methods.size()))) {
+					return false;
+				}
+				for (SQUnsignedInteger i = 0; i < cls->_methods.size(); i++) {
+					if (!write_value(cls->_methods[i].val) || !write_value(cls->_methods[i].attrs)) {
+						return false;
+					}
+				}
+				if (!write_raw<SQInteger>(SQInteger(cls->_defaultvalues.size()))) {
+					return false;
+				}
+				for (SQUnsignedInteger i = 0; i < cls->_defaultvalues.size(); i++) {
+					if (!write_value(cls->_defaultvalues[i].val) || !write_value(cls->_defaultvalues[i].attrs)) {
+						return false;
+					}
+				}
+				for (SQInteger i = 0; i < MT_LAST; i++) {
+					if (!write_value(cls->_metamethods[i])) {
+						return false;
+					}
+				}
+				return write_value(cls->_attributes) && write_raw<unsigned char>(cls->_locked ? 1 : 0) && write_raw<SQInteger>(cls->_constructoridx);
+			}
+			case OT_INSTANCE: {
+				SQInstance *instance = _instance(obj);
+				const SQUnsignedInteger count = instance->_class->_defaultvalues.size();
+				if (!write_raw<SQInteger>(SQInteger(count))) {
+					return false;
+				}
+				for (SQUnsignedInteger i = 0; i < count; i++) {
+					if (!write_value(instance->_values[i])) {
+						return false;
+					}
+				}
+				return true;
+			}
+			default:
+				return true;
+		}
+	}
+
+	bool needs_fill(const SQObjectPtr &obj) const {
+		switch (sq_type(obj)) {
+			case OT_TABLE:
+			case OT_ARRAY:
+			case OT_CLOSURE:
+			case OT_OUTER:
+			case OT_INSTANCE:
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	bool run() {
+		SQObjectPtr *roots[IMAGE_ROOT_COUNT];
+		get_image_roots(vm, roots);
+		for (SQInteger i = 0; i < IMAGE_ROOT_COUNT; i++) {
+			ImageObject entry;
+			entry.obj = *roots[i];
+			entry.parent = IMAGE_ROOT;
+			entry.key = SQObjectPtr(i);
+			_table(ids)->NewSlot(entry.obj, SQObjectPtr(i));
+			objects.push_back(entry);
+		}
+
+		for (SQInteger i = 0; i < SQInteger(objects.size()); i++) {
+			visit(i);
+		}
+
+		const SQInteger count = SQInteger(objects.size());
+		SQInteger instances = 0;
+		SQInteger classes = 0;
+		SQInteger fills = 0;
+		for (SQInteger i = IMAGE_ROOT_COUNT; i < count; i++) {
+			const SQObjectPtr &obj = objects[i].obj;
+			instances += sq_type(obj) == OT_INSTANCE;
+			classes += sq_type(obj) == OT_CLASS && !is_native(obj);
+		}
+		for (SQInteger i = 0; i < count; i++) {
+			fills += needs_fill(objects[i].obj);
+		}
+
+		// records mirror private Squirrel structures, so the Squirrel version is part of the format
+		if (!write_raw<unsigned int>(SQUIRREL_IMAGE_MAGIC) || !write_raw<unsigned int>(SQUIRREL_IMAGE_VERSION) || !write_raw<unsigned int>(SQUIRREL_VERSION_NUMBER) || !write_raw<unsigned int>(sizeof(SQInteger)) || !write_raw<unsigned int>(sizeof(SQFloat)) || !write_raw<SQInteger>(count)) {
+			return false;
+		}
+
+		// 1: everything except instances, which need their class to be filled first
+		if (!write_raw<SQInteger>(count - IMAGE_ROOT_COUNT - instances)) {
+			return false;
+		}
+		for (SQInteger i = IMAGE_ROOT_COUNT; i < count; i++) {
+			if (sq_type(objects[i].obj) != OT_INSTANCE && !write_creation(i)) {
+				return false;
+			}
+		}
+
+		// 2: classes
+		if (!write_raw<SQInteger>(classes)) {
+			return false;
+		}
+		for (SQInteger i = IMAGE_ROOT_COUNT; i < count; i++) {
+			if (sq_type(objects[i].obj) == OT_CLASS && !is_native(objects[i].obj) && !write_fill(i)) {
+				return false;
+			}
+		}
+
+		// 3: instances
+		if (!write_raw<SQInteger>(instances)) {
+			return false;
+		}
+		for (SQInteger i = IMAGE_ROOT_COUNT; i < count; i++) {
+			if (sq_type(objects[i].obj) == OT_INSTANCE && !write_creation(i)) {
+				return false;
+			}
+		}
+
+		// 4: everything else
+		if (!write_raw<SQInteger>(fills)) {
+			return false;
+		}
+		for (SQInteger i = 0; i < count; i++) {
+			if (needs_fill(objects[i].obj) && !write_fill(i)) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+};
+
+struct ImageReader {
+	SQVM *vm = nullptr;
+	SQREADFUNC read_func = nullptr;
+	SQUserPointer up = nullptr;
+	SQRESULT (*read_userdata)(HSQUIRRELVM vm, SQREADFUNC read, SQUserPointer up) = nullptr;
+	SQBool (*resolve_native)(HSQUIRRELVM vm, const SQChar *name, void *userdata) = nullptr;
+	void *resolve_userdata = nullptr;
+
+	sqvector<SQObjectPtr> objects;
+	SQObjectPtr original_roots[IMAGE_ROOT_COUNT];
+	const SQChar *error = nullptr;
+
+	bool fail(const SQChar *message) {
+		if (error == nullptr) {
+			error = message;
+		}
+		return false;
+	}
+
+	bool read(void *data, SQInteger size) {
+		return read_func(up, data, size) == size || fail(_SC("the image is truncated"));
+	}
+
+	template <typename T>
+	bool read_raw(T &value) {
+		return read(&value, sizeof(T));
+	}
+
+	bool read_id(SQInteger &id) {
+		return read_raw(id) && ((id >= 0 && id < SQInteger(objects.size())) || fail(_SC("the image is corrupt")));
+	}
+
+	bool read_value(SQObjectPtr &value) {
+		unsigned char tag = 0;
+		if (!read_raw(tag)) {
+			return false;
+		}
+		switch (tag) {
+			case IMAGE_NULL:
+				value.Null();
+				return true;
+			case IMAGE_INTEGER: {
+				SQInteger i = 0;
+				return read_raw(i) && ((value = SQObjectPtr(i)), true);
+			}
+			case IMAGE_FLOAT: {
+				SQFloat f = 0;
+				return read_raw(f) && ((value = SQObjectPtr(f)), true);
+			}
+			case IMAGE_BOOL: {
+				unsigned char b = 0;
+				return read_raw(b) && ((value = SQObjectPtr(b != 0)), true);
+			}
+			case IMAGE_STRING: {
+				SQInteger length = 0;
+				if (!read_raw(length) || length < 0) {
+					return fail(_SC("the image is corrupt"));
+				}
+				SQChar *buffer = _ss(vm)->GetScratchPad(sq_rsl(length));
+				if (!read(buffer, sq_rsl(length))) {
+					return false;
+				}
+				value = SQString::Create(_ss(vm), buffer, length);
+				return true;
+			}
+			case IMAGE_REF: {
+				SQInteger id = 0;
+				if (!read_id(id) || sq_type(objects[id]) == OT_NULL) {
+					return fail(_SC("the image is corrupt"));
+				}
+				value = objects[id];
+				return true;
+			}
+			case IMAGE_WEAKREF: {
+				SQInteger id = 0;
+				if (!read_id(id) || !ISREFCOUNTED(sq_type(objects[id]))) {
+					return fail(_SC("the image is corrupt"));
+				}
+				value = objects[id]._unVal.pRefCounted->GetWeakRef(sq_type(objects[id]));
+				return true;
+			}
+			default:
+				return fail(_SC("the image is corrupt"));
+		}
+	}
+
+	bool resolve_path(SQObjectPtr &value) {
+		SQInteger root = 0;
+		SQInteger length = 0;
+		if (!read_raw(root) || !read_raw(length) || root < 0 || root >= IMAGE_ROOT_COUNT || length < 0) {
+			return fail(_SC("the image is corrupt"));
+		}
+
+		value = original_roots[root];
+		bool found = true;
+		for (SQInteger i = 0; i < length; i++) {
+			SQObjectPtr key;
+			if (!read_value(key)) {
+				return false;
+			}
+			SQObjectPtr next;
+			if (found && sq_type(value) == OT_TABLE && _table(value)->Get(key, next)) {
+				value = next;
+			} else if (found && sq_type(value) == OT_CLASS && _class(value)->Get(key, next)) {
+				value = next;
+			} else {
+				found = false;
+			}
+		}
+
+		return found;
+	}
+
+	bool read_creation() {
+		SQInteger id = 0;
+		unsigned char type = 0;
+		if (!read_id(id) || id < IMAGE_ROOT_COUNT || !read_raw(type)) {
+			return fail(_SC("the image is corrupt"));
+		}
+
+		SQObjectPtr &obj = objects[id];
+		switch (type) {
+			case IMAGE_TABLE: {
+				SQInteger size = 0;
+				if (!read_raw(size) || size < 0) {
+					return fail(_SC("the image is corrupt"));
+				}
+				obj = SQTable::Create(_ss(vm), size);
+				return true;
+			}
+			case IMAGE_ARRAY: {
+				SQInteger size = 0;
+				if (!read_raw(size) || size < 0) {
+					return fail(_SC("the image is corrupt"));
+				}
+				obj = SQArray::Create(_ss(vm), size);
+				return true;
+			}
+			case IMAGE_PROTO: {
+				SQInteger size = 0;
+				if (!read_raw(size) || size < 0) {
+					return fail(_SC("the image is corrupt"));
+				}
+				ProtoBuffer buffer;
+				buffer.data.resize(size);
+				if (!read(size ? &buffer.data[0] : nullptr, size)) {
+					return false;
+				}
+				if (!SQFunctionProto::Load(vm, &buffer, &ProtoBuffer::read, obj)) {
+					return fail(_SC("could not load a function prototype"));
+				}
+				return true;
+			}
+			case IMAGE_CLOSURE: {
+				SQObjectPtr proto;
+				if (!read_value(proto) || sq_type(proto) != OT_FUNCPROTO) {
+					return fail(_SC("the image is corrupt"));
+				}
+				obj = SQClosure::Create(_ss(vm), _funcproto(proto), _table(vm->_roottable)->GetWeakRef(OT_TABLE));
+				return true;
+			}
+			case IMAGE_NATIVE: {
+				SQObjectPtr name;
+				if (!read_value(name)) {
+					return false;
+				}
+				SQObjectPtr resolved;
+				const bool found = resolve_path(resolved);
+				if (error) {
+					return false;
+				}
+				if (resolve_native && sq_type(name) == OT_STRING && resolve_native(vm, _stringval(name), resolve_userdata)) {
+					obj = vm->Top();
+					vm->Pop();
+					return true;
+				}
+				if (!found || (sq_type(resolved) != OT_NATIVECLOSURE && sq_type(resolved) != OT_CLASS)) {
+					return fail(_SC("a native function or class used by the image is missing from this VM"));
+				}
+				obj = resolved;
+				return true;
+			}
+			case IMAGE_OUTER:
+				obj = SQObjectPtr(SQOuter::Create(_ss(vm), nullptr));
+				_outer(obj)->_valptr = &_outer(obj)->_value;
+				return true;
+			case IMAGE_CLASS: {
+				SQObjectPtr base;
+				if (!read_value(base) || (sq_type(base) != OT_NULL && sq_type(base) != OT_CLASS)) {
+					return fail(_SC("the image is corrupt"));
+				}
+				obj = SQClass::Create(_ss(vm), sq_type(base) == OT_CLASS ? _class(base) : nullptr);
+				return true;
+			}
+			case IMAGE_INSTANCE: {
+				SQObjectPtr cls;
+				if (!read_value(cls) || sq_type(cls) != OT_CLASS) {
+					return fail(_SC("the image is corrupt"));
+				}
+				obj = SQInstance::Create(_ss(vm), _class(cls));
+				return true;
+			}
+			case IMAGE_USERDATA:
+				if (read_userdata == nullptr || SQ_FAILED(read_userdata(vm, read_func, up)) || sq_type(vm->Top()) != OT_USERDATA) {
+					return fail(_SC("could not load userdata"));
+				}
+				obj = vm->Top();
+				vm->Pop();
+				return true;
+			default:
+				return fail(_SC("the image is corrupt"));
+		}
+	}
+
+	bool read_member_vector(SQClassMemberVec &members) {
+		SQInteger count = 0;
+		if (!read_raw(count) || count < 0) {
+			return fail(_SC("the image is corrupt"));
+		}
+		members.resize(count);
+		for (SQInteger i = 0; i < count; i++) {
+			if (!read_value(members[i].val) || !read_value(members[i].attrs)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool read_fill() {
+		SQInteger id = 0;
+		if (!read_id(id)) {
+			return false;
+		}
+
+		const SQObjectPtr obj = objects[id];
+		switch (sq_type(obj)) {
+			case OT_TABLE: {
+				SQObjectPtr delegate;
+				SQInteger count = 0;
+				if (!read_value(delegate) || !read_raw(count)) {
+					return false;
+				}
+				if (sq_type(delegate) == OT_TABLE) {
+					_table(obj)->SetDelegate(_table(delegate));
+				}
+				for (SQInteger i = 0; i < count; i++) {
+					SQObjectPtr key, value;
+					if (!read_value(key) || !read_value(value)) {
+						return false;
+					}
+					if (sq_type(key) == OT_NULL) {
+						return fail(_SC("the image is corrupt"));
+					}
+					_table(obj)->NewSlot(key, value);
+				}
+				return true;
+			}
+			case OT_ARRAY:
+				for (SQInteger i = 0; i < _array(obj)->Size(); i++) {
+					if (!read_value(_array(obj)->_values[i])) {
+						return false;
+					}
+				}
+				return true;
+			case OT_CLOSURE: {
+				SQClosure *closure = _closure(obj);
+				for (SQInteger i = 0; i < closure->_function->_noutervalues; i++) {
+					if (!read_value(closure->_outervalues[i])) {
+						return false;
+					}
+				}
+				for (SQInteger i = 0; i < closure->_function->_ndefaultparams; i++) {
+					if (!read_value(closure->_defaultparams[i])) {
+						return false;
+					}
+				}
+				SQObjectPtr env, base;
+				if (!read_value(env) || !read_value(base)) {
+					return false;
+				}
+				if (ISREFCOUNTED(sq_type(env))) {
+					closure->_env = env._unVal.pRefCounted->GetWeakRef(sq_type(env));
+					__ObjAddRef(closure->_env);
+				}
+				if (sq_type(base) == OT_CLASS) {
+					closure->_base = _class(base);
+					__ObjAddRef(closure->_base);
+				}
+				return true;
+			}
+			case OT_OUTER:
+				return read_value(_outer(obj)->_value);
+			case OT_CLASS: {
+				SQClass *cls = _class(obj);
+				SQInteger count = 0;
+				if (!read_raw(count)) {
+					return false;
+				}
+				for (SQInteger i = 0; i < count; i++) {
+					SQObjectPtr key, value;
+					if (!read_value(key) || !read_value(value) || sq_type(key) == OT_NULL) {
+						return fail(_SC("the image is corrupt"));
+					}
+					cls->_members->NewSlot(key, value);
+				}
+				if (!read_member_vector(cls->_methods) || !read_member_vector(cls->_defaultvalues)) {
+					return false;
+				}
+				for (SQInteger i = 0; i < MT_LAST; i++) {
+					if (!read_value(cls->_metamethods[i])) {
+						return false;
+					}
+				}
+				unsigned char locked = 0;
+				return read_value(cls->_attributes) && read_raw(locked) && read_raw(cls->_constructoridx) && ((cls->_locked = locked != 0), true);
+			}
+			case OT_INSTANCE: {
+				SQInteger count = 0;
+				if (!read_raw(count) || count != SQInteger(_instance(obj)->_class->_defaultvalues.size())) {
+					return fail(_SC("the image is corrupt"));
+				}
+				for (SQInteger i = 0; i < count; i++) {
+					if (!read_value(_instance(obj)->_values[i])) {
+						return false;
+					}
+				}
+				return true;
+			}
+			default:
+				return fail(_SC("the image is corrupt"));
+		}
+	}
+
+	// puts back the contents the root tables had before loading started
+	void restore_roots() {
+		SQObjectPtr *roots[IMAGE_ROOT_COUNT];
+		get_image_roots(vm, roots);
+		for (SQInteger i = 0; i < IMAGE_ROOT_COUNT; i++) {
+			if (sq_type(original_roots[i]) != OT_TABLE) {
+				continue;
+			}
+
+			SQTable *table = _table(*roots[i]);
+			SQTable *original = _table(original_roots[i]);
+			table->Clear();
+			table->SetDelegate(original->_delegate);
+
+			SQInteger ridx = 0;
+			SQObjectPtr key, value;
+			while ((ridx = original->Next(true, SQObjectPtr(ridx), key, value)) != -1) {
+				table->NewSlot(key, value);
+			}
+		}
+	}
+
+	bool run() {
+		if (load()) {
+			return true;
+		}
+
+		restore_roots();
+		return false;
+	}
+
+	bool load() {
+		unsigned int magic = 0, version = 0, squirrel_version = 0, integer_size = 0, float_size = 0;
+		if (!read_raw(magic) || !read_raw(version)) {
+			return false;
+		}
+		if (magic != SQUIRREL_IMAGE_MAGIC || version != SQUIRREL_IMAGE_VERSION) {
+			return fail(_SC("not a Squirrel VM image"));
+		}
+		if (!read_raw(squirrel_version) || !read_raw(integer_size) || !read_raw(float_size)) {
+			return false;
+		}
+		if (squirrel_version != SQUIRREL_VERSION_NUMBER || integer_size != sizeof(SQInteger) || float_size != sizeof(SQFloat)) {
+			return fail(_SC("the image was saved by an incompatible build"));
+		}
+
+		SQInteger count = 0;
+		if (!read_raw(count) || count < IMAGE_ROOT_COUNT) {
+			return fail(_SC("the image is corrupt"));
+		}
+		objects.resize(count);
+
+		// natives are looked up in copies of the tables as they were before loading,
+		// and the copies are put back if loading fails
+		SQObjectPtr *roots[IMAGE_ROOT_COUNT];
+		get_image_roots(vm, roots);
+		for (SQInteger i = 0; i < IMAGE_ROOT_COUNT; i++) {
+			if (sq_type(*roots[i]) != OT_TABLE) {
+				return fail(_SC("the VM is missing a root table"));
+			}
+		}
+		for (SQInteger i = 0; i < IMAGE_ROOT_COUNT; i++) {
+			original_roots[i] = _table(*roots[i])->Clone();
+			_table(*roots[i])->Clear();
+			objects[i] = *roots[i];
+		}
+
+		for (SQInteger phase = 0; phase < 4; phase++) {
+			SQInteger records = 0;
+			if (!read_raw(records) || records < 0 || records > count) {
+				return fail(_SC("the image is corrupt"));
+			}
+			for (SQInteger i = 0; i < records; i++) {
+				const bool ok = (phase == 0 || phase == 2) ? read_creation() : read_fill();
+				if (!ok) {
+					return false;
+				}
+			}
+		}
+
+		return true;
+	}
+};
+} //namespace
+
+SQRESULT godot_squirrel_save_image(HSQUIRRELVM vm, SQWRITEFUNC write, SQUserPointer up, SQRESULT (*write_userdata)(HSQUIRRELVM vm, const HSQOBJECT *obj, SQWRITEFUNC write, SQUserPointer up)) {
+	if (sq_getvmstate(vm) != SQ_VMSTATE_IDLE || vm->_callsstacksize != 0) {
+		return sq_throwerror(vm, _SC("cannot save a VM that is running"));
+	}
+
+	ImageWriter writer;
+	writer.vm = vm;
+	writer.write_func = write;
+	writer.up = up;
+	writer.write_userdata = write_userdata;
+	writer.ids = SQTable::Create(_ss(vm), 0);
+
+	if (!writer.run()) {
+		return sq_throwerror(vm, writer.error ? writer.error : _SC("could not save the image"));
+	}
+
+	return SQ_OK;
+}
+
+SQRESULT godot_squirrel_load_image(HSQUIRRELVM vm, SQREADFUNC read, SQUserPointer up, SQRESULT (*read_userdata)(HSQUIRRELVM vm, SQREADFUNC read, SQUserPointer up), SQBool (*resolve_native)(HSQUIRRELVM vm, const SQChar *name, void *userdata), void *userdata) {
+	if (sq_getvmstate(vm) != SQ_VMSTATE_IDLE || vm->_callsstacksize != 0) {
+		return sq_throwerror(vm, _SC("cannot load an image into a VM that is running"));
+	}
+
+	ImageReader reader;
+	reader.vm = vm;
+	reader.read_func = read;
+	reader.up = up;
+	reader.read_userdata = read_userdata;
+	reader.resolve_native = resolve_native;
+	reader.resolve_userdata = userdata;
+
+	if (!reader.run()) {
+		return sq_throwerror(vm, reader.error ? reader.error : _SC("could not load the image"));
+	}
+
+	return SQ_OK;
+}
+
+// approximate size of an object's own allocations, not counting other objects
+// it refers to. table nodes are private to SQTable, so their count is estimated.
+static SQInteger get_object_size(const SQObjectPtr &obj) {
+	switch (sq_type(obj)) {
+		case OT_STRING:
+			return sizeof(SQString) + sq_rsl(_string(obj)->_len);
+		case OT_TABLE: {
+			SQInteger nodes = 1;
+			while (nodes < _table(obj)->CountUsed()) {
+				nodes <<= 1;
+			}
+			return sizeof(SQTable) + nodes * (sizeof(SQObjectPtr) * 2 + sizeof(void *));
+		}
+		case OT_ARRAY:
+			return sizeof(SQArray) + _array(obj)->_values.capacity() * sizeof(SQObjectPtr);
+		case OT_CLOSURE:
+			return _CALC_CLOSURE_SIZE(_closure(obj)->_function);
+		case OT_NATIVECLOSURE:
+			return _CALC_NATVIVECLOSURE_SIZE(_nativeclosure(obj)->_noutervalues);
+		case OT_FUNCPROTO: {
+			const SQFunctionProto *proto = _funcproto(obj);
+			return _FUNC_SIZE(proto->_ninstructions, proto->_nliterals, proto->_nparameters, proto->_nfunctions, proto->_noutervalues, proto->_nlineinfos, proto->_nlocalvarinfos, proto->_ndefaultparams);
+		}
+		case OT_GENERATOR:
+			return sizeof(SQGenerator) + _generator(obj)->_stack.capacity() * sizeof(SQObjectPtr);
+		case OT_USERDATA:
+			return sizeof(SQUserData) + _userdata(obj)->_size;
+		case OT_THREAD:
+			return sizeof(SQVM) + _thread(obj)->_stack.capacity() * sizeof(SQObjectPtr) + _thread(obj)->_callstackdata.capacity() * sizeof(SQVM::CallInfo);
+		case OT_CLASS:
+			return sizeof(SQClass) + (_class(obj)->_defaultvalues.capacity() + _class(obj)->_methods.capacity()) * sizeof(SQClassMember);
+		case OT_INSTANCE:
+			return _instance(obj)->_memsize;
+		case OT_OUTER:
+			return sizeof(SQOuter);
+		case OT_WEAKREF:
+			return sizeof(SQWeakRef);
+		default:
+			return 0;
+	}
+}
+
+// calls visit(child, kind, key) for every strong reference held by an object.
+// key is the slot name or index when there is one, and null otherwise.
+template <typename F>
+static void for_each_reference(const SQObjectPtr &obj, F &&visit) {
+	const SQObjectPtr none;
+	switch (sq_type(obj)) {
+		case OT_TABLE: {
+			SQTable *table = _table(obj);
+			if (table->_delegate) {
+				visit(SQObjectPtr(table->_delegate), _SC("delegate"), none);
+			}
+			SQInteger ridx = 0;
+			SQObjectPtr key, value;
+			while ((ridx = table->Next(true, SQObjectPtr(ridx), key, value)) != -1) {
+				visit(key, _SC("key"), key);
+				visit(value, _SC("slot"), key);
+			}
+			break;
+		}
+		case OT_ARRAY: {
+			SQArray *array = _array(obj);
+			for (SQInteger i = 0; i < array->Size(); i++) {
+				visit(array->_values[i], _SC("index"), SQObjectPtr(i));
+			}
+			break;
+		}
+		case OT_CLOSURE: {
+			SQClosure *closure = _closure(obj);
+			visit(SQObjectPtr(closure->_function), _SC("function"), none);
+			for (SQInteger i = 0; i < closure->_function->_noutervalues; i++) {
+				visit(closure->_outervalues[i], _SC("outer"), SQObjectPtr(i));
+			}
+			for (SQInteger i = 0; i < closure->_function->_ndefaultparams; i++) {
+				visit(closure->_defaultparams[i], _SC("default"), SQObjectPtr(i));
+			}
+			if (closure->_base) {
+				visit(SQObjectPtr(closure->_base), _SC("base"), none);
+			}
+			break;
+		}
+		case OT_NATIVECLOSURE: {
+			SQNativeClosure *closure = _nativeclosure(obj);
+			for (SQUnsignedInteger i = 0; i < closure->_noutervalues; i++) {
+				visit(closure->_outervalues[i], _SC("outer"), SQObjectPtr(SQInteger(i)));
+			}
+			visit(closure->_name, _SC("name"), none);
+			break;
+		}
+		case OT_FUNCPROTO: {
+			SQFunctionProto *proto = _funcproto(obj);
+			visit(proto->_name, _SC("name"), none);
+			visit(proto->_sourcename, _SC("source"), none);
+			for (SQInteger i = 0; i < proto->_nliterals; i++) {
+				visit(proto->_literals[i], _SC("literal"), SQObjectPtr(i));
+			}
+			for (SQInteger i = 0; i < proto->_nfunctions; i++) {
+				visit(proto->_functions[i], _SC("function"), SQObjectPtr(i));
+			}
+			break;
+		}
+		case OT_OUTER:
+			visit(_outer(obj)->_value, _SC("value"), none);
+			break;
+		case OT_GENERATOR: {
+			SQGenerator *generator = _generator(obj);
+			visit(generator->_closure, _SC("function"), none);
+			for (SQUnsignedInteger i = 0; i < generator->_stack.size(); i++) {
+				visit(generator->_stack[i], _SC("stack"), SQObjectPtr(SQInteger(i)));
+			}
+			break;
+		}
+		case OT_THREAD: {
+			SQVM *thread = _thread(obj);
+			visit(thread->_roottable, _SC("roottable"), none);
+			for (SQInteger i = 0; i < thread->_top; i++) {
+				visit(thread->_stack[i], _SC("stack"), SQObjectPtr(i));
+			}
+			break;
+		}
+		case OT_CLASS: {
+			SQClass *cls = _class(obj);
+			if (cls->_base) {
+				visit(SQObjectPtr(cls->_base), _SC("base"), none);
+			}
+			SQInteger ridx = 0;
+			SQObjectPtr key, value;
+			while ((ridx = cls->_members->Next(true, SQObjectPtr(ridx), key, value)) != -1) {
+				SQObjectPtr member;
+				cls->Get(key, member);
+				visit(member, _SC("member"), key);
+			}
+			for (SQInteger i = 0; i < MT_LAST; i++) {
+				visit(cls->_metamethods[i], _SC("metamethod"), none);
+			}
+			visit(cls->_attributes, _SC("attributes"), none);
+			break;
+		}
+		case OT_INSTANCE: {
+			SQInstance *instance = _instance(obj);
+			visit(SQObjectPtr(instance->_class), _SC("class"), none);
+			SQInteger ridx = 0;
+			SQObjectPtr key, value;
+			while ((ridx = instance->_class->_members->Next(true, SQObjectPtr(ridx), key, value)) != -1) {
+				if (_isfield(value)) {
+					visit(instance->_values[_member_idx(value)], _SC("field"), key);
+				}
+			}
+			break;
+		}
+		case OT_USERDATA:
+			if (_userdata(obj)->_delegate) {
+				visit(SQObjectPtr(_userdata(obj)->_delegate), _SC("delegate"), none);
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+SQRESULT godot_squirrel_heap_census(HSQUIRRELVM vm, void (*visit)(void *userdata, const HSQOBJECT *obj, SQInteger bytes), void *userdata) {
+#ifdef NO_GARBAGE_COLLECTOR
+	return sq_throwerror(vm, _SC("the heap can't be enumerated without the garbage collector"));
+#else
+	// strings aren't collectable, so they're found through the objects using them
+	// new objects are added at the head of the chain, so the table used to
+	// track strings is not part of the walk
+	SQCollectable *first = _ss(vm)->_gc_chain;
+	SQObjectPtr strings = SQObjectPtr(SQTable::Create(_ss(vm), 0));
+
+	const auto report = [&](const SQObjectPtr &obj) {
+		const HSQOBJECT handle = obj;
+		visit(userdata, &handle, get_object_size(obj));
+	};
+	const auto find_strings = [&](const SQObjectPtr &child, const SQChar *, const SQObjectPtr &) {
+		SQObjectPtr seen;
+		if (sq_type(child) == OT_STRING && !_table(strings)->Get(child, seen)) {
+			_table(strings)->NewSlot(child, SQObjectPtr(true));
+			report(child);
+		}
+	};
+
+	for (SQCollectable *collectable = first; collectable != nullptr; collectable = collectable->_next) {
+		SQObject raw;
+		raw._type = collectable->GetType();
+		raw._unVal.pRefCounted = collectable;
+		const SQObjectPtr obj(raw);
+
+		report(obj);
+		for_each_reference(obj, find_strings);
+	}
+
+	return SQ_OK;
+#endif
+}
+
+SQRESULT godot_squirrel_walk_heap(HSQUIRRELVM vm, const HSQOBJECT *roots, SQInteger root_count, void (*visit)(void *userdata, const HSQOBJECT *obj, SQInteger bytes, SQInteger parent, const SQChar *kind, const HSQOBJECT *key), void *userdata) {
+	SQObjectPtr indices = SQObjectPtr(SQTable::Create(_ss(vm), 0));
+	sqvector<SQObjectPtr> queue;
+
+	SQInteger parent = -1;
+	const auto discover = [&](const SQObjectPtr &obj, const SQChar *kind, const SQObjectPtr &key) {
+		if (!ISREFCOUNTED(sq_type(obj)) || sq_type(obj) == OT_WEAKREF) {
+			return;
+		}
+
+		SQObjectPtr index;
+		if (_table(indices)->Get(obj, index)) {
+			return;
+		}
+
+		_table(indices)->NewSlot(obj, SQObjectPtr(SQInteger(queue.size())));
+		queue.push_back(obj);
+
+		const HSQOBJECT handle = obj;
+		const HSQOBJECT key_handle = key;
+		visit(userdata, &handle, get_object_size(obj), parent, kind, sq_type(key) == OT_NULL ? nullptr : &key_handle);
+	};
+
+	for (SQInteger i = 0; i < root_count; i++) {
+		discover(SQObjectPtr(roots[i]), _SC("root"), SQObjectPtr(i));
+	}
+
+	for (SQUnsignedInteger i = 0; i < queue.size(); i++) {
+		parent = SQInteger(i);
+		const SQObjectPtr obj = queue[i];
+		for_each_reference(obj, discover);
+	}
+
+	return SQ_OK;
+}
+
+// shrinks a thread's value stack to what its live frames need, and its call
+// stack to its current depth. open outers point into the value stack, so they
+// are relocated the same way as when it grows.
+SQRESULT godot_squirrel_shrink_stack(HSQUIRRELVM vm) {
+	if (sq_getvmstate(vm) == SQ_VMSTATE_RUNNING) {
+		return sq_throwerror(vm, _SC("cannot shrink the stack of a running thread"));
+	}
+
+	// keep the headroom SQVM::EnterFrame guarantees, which natives rely on
+	const SQUnsignedInteger stack_size = SQUnsignedInteger(vm->_top + (MIN_STACK_OVERHEAD << 1));
+	if (stack_size < vm->_stack.size()) {
+		vm->_stack.resize(stack_size);
+		vm->_stack.shrinktofit();
+		vm->RelocateOuters();
+	}
+
+	const SQInteger calls_size = vm->_callsstacksize > 4 ? vm->_callsstacksize : 4;
+	if (calls_size < vm->_alloccallsstacksize) {
+		vm->_callstackdata.resize(calls_size);
+		vm->_callstackdata.shrinktofit();
+		vm->_alloccallsstacksize = calls_size;
+		vm->_callsstack = &vm->_callstackdata[0];
+		vm->ci = vm->_callsstacksize > 0 ? &vm->_callsstack[vm->_callsstacksize - 1] : nullptr;
+	}
+
+	return SQ_OK;
+}
+
+SQInteger godot_squirrel_get_stack_memory_usage(HSQUIRRELVM vm) {
+	return get_object_size(SQObjectPtr(vm));
+}
+
+// returns an idle thread to the state sq_newthread leaves it in, with the
+// settings it would inherit from the VM if it were created now
+SQRESULT godot_squirrel_reset_thread(HSQUIRRELVM vm) {
+	SQVM *root = _thread(_ss(vm)->_root_vm);
+	if (vm == root) {
+		return sq_throwerror(vm, _SC("cannot reset the main thread of a VM"));
+	}
+	if (sq_getvmstate(vm) != SQ_VMSTATE_IDLE || vm->_callsstacksize != 0) {
+		return sq_throwerror(vm, _SC("cannot reset a thread that is not idle"));
+	}
+
+	sq_settop(vm, 0);
+	sq_reseterror(vm);
+	vm->_roottable = root->_roottable;
+	vm->_errorhandler = root->_errorhandler;
+	vm->_debughook = root->_debughook;
+	vm->_debughook_native = root->_debughook_native;
+	vm->_debughook_closure = root->_debughook_closure;
+	vm->_notifyallexceptions = root->_notifyallexceptions;
+	vm->_foreignptr = nullptr;
+	vm->_releasehook = nullptr;
+
+	return godot_squirrel_shrink_stack(vm);
+}
+
+// sq_getrefcount only counts sq_addref calls; this counts every strong reference,
+// where all of those sq_addref calls together count as one
+SQUnsignedInteger godot_squirrel_get_refcount(const HSQOBJECT *obj) {
+	return ISREFCOUNTED(sq_type(*obj)) ? obj->_unVal.pRefCounted->_uiRef : 0;
+}
+
+// what sq_newclosure and sq_setparamscheck were given for a native closure,
+// so an identical one can be created later in any VM. closures with free
+// variables carry state of their own and are rejected.
+SQRESULT godot_squirrel_get_native_closure_info(HSQUIRRELVM vm, SQInteger idx, SQFUNCTION *func, SQInteger *nparamscheck, const SQInteger **typemasks, SQInteger *typemask_count) {
+	HSQOBJECT obj;
+	if (SQ_FAILED(sq_getstackobj(vm, idx, &obj)) || !sq_isnativeclosure(obj)) {
+		return sq_throwerror(vm, _SC("expected a native closure"));
+	}
+
+	const SQNativeClosure *closure = obj._unVal.pNativeClosure;
+	if (closure->_noutervalues != 0) {
+		return sq_throwerror(vm, _SC("native closure has free variables"));
+	}
+
+	*func = closure->_function;
+	*nparamscheck = closure->_nparamscheck;
+	*typemasks = closure->_typecheck.size() > 0 ? &closure->_typecheck[0] : nullptr;
+	*typemask_count = SQInteger(closure->_typecheck.size());
+
+	return SQ_OK;
+}
+
+// the typemask counterpart of sq_setparamscheck, for masks that were already parsed
+SQRESULT godot_squirrel_set_native_closure_paramscheck(HSQUIRRELVM vm, SQInteger idx, SQInteger nparamscheck, const SQInteger *typemasks, SQInteger typemask_count) {
+	HSQOBJECT obj;
+	if (SQ_FAILED(sq_getstackobj(vm, idx, &obj)) || !sq_isnativeclosure(obj)) {
+		return sq_throwerror(vm, _SC("expected a native closure"));
+	}
+
+	SQNativeClosure *closure = obj._unVal.pNativeClosure;
+	closure->_nparamscheck = nparamscheck;
+	closure->_typecheck.resize(0);
+	for (SQInteger i = 0; i < typemask_count; i++) {
+		closure->_typecheck.push_back(typemasks[i]);
+	}
+
+	return SQ_OK;
+}
+
+// sq_setnativedebughook for every thread sharing vm's state, including ones
+// that were created before the hook was set. without a gc chain there is no
+// list of threads, so only threads created afterwards inherit it.
+void godot_squirrel_set_native_debug_hook(HSQUIRRELVM vm, SQDEBUGHOOK hook) {
+#ifdef NO_GARBAGE_COLLECTOR
+	sq_setnativedebughook(_thread(_ss(vm)->_root_vm), hook);
+#else
+	for (SQCollectable *collectable = _ss(vm)->_gc_chain; collectable != nullptr; collectable = collectable->_next) {
+		if (collectable->GetType() == OT_THREAD) {
+			sq_setnativedebughook(static_cast<SQVM *>(collectable), hook);
+		}
+	}
+#endif
+}
+
+namespace {
+// one _OP_THROW per register a frame can have, so a frame can be made to
+// throw without rewriting its own instructions
+struct ThrowInstructions {
+	SQInstruction code[256];
+
+	ThrowInstructions() {
+		for (SQInteger i = 0; i < 256; i++) {
+			code[i] = SQInstruction(_OP_THROW, i);
+		}
+	}
+};
+ThrowInstructions throw_instructions;
+} //namespace
+
+// makes the script running on vm throw error as its next instruction, in a
+// way try/catch can handle. only valid from a native debug hook, which runs
+// between two instructions of the current frame. the error is kept in the
+// first free register above the frame; the frame's own registers and code are
+// untouched, but its line in the error handler's call stack is not accurate.
+SQBool godot_squirrel_throw_from_debug_hook(HSQUIRRELVM vm, const SQChar *error) {
+	if (vm->ci == nullptr || sq_type(vm->ci->_closure) != OT_CLOSURE) {
+		return SQFalse;
+	}
+
+	// a generator's first frame is saved as soon as it is called, so the throw
+	// would be delayed until it is resumed
+	if (_closure(vm->ci->_closure)->_function->_bgenerator) {
+		return SQFalse;
+	}
+
+	// EnterFrame leaves at least MIN_STACK_OVERHEAD slots above the frame
+	const SQInteger target = vm->_top - vm->_stackbase;
+	if (target < 0 || target >= 256 || vm->_top >= SQInteger(vm->_stack.size())) {
+		return SQFalse;
+	}
+
+	vm->_stack._vals[vm->_top] = SQString::Create(_ss(vm), error, -1);
+	vm->ci->_ip = &throw_instructions.code[target];
+
+	return SQTrue;
+}
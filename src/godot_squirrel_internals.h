@@ -4,3 +4,22 @@
 
 SQUIRREL_API SQInteger godot_squirrel_get_generator_state(const HSQOBJECT *obj);
 SQUIRREL_API void godot_squirrel_push_call_closure(HSQUIRRELVM vm, SQInteger level);
+SQUIRREL_API SQRESULT godot_squirrel_get_closure_proto(HSQUIRRELVM vm, SQInteger idx, HSQOBJECT *proto);
+SQUIRREL_API SQRESULT godot_squirrel_new_closure_from_proto(HSQUIRRELVM vm, const HSQOBJECT *proto);
+SQUIRREL_API SQRESULT godot_squirrel_optimize_closure(HSQUIRRELVM vm, SQInteger idx, SQInteger *instructions_before, SQInteger *instructions_after);
+SQUIRREL_API SQBool godot_squirrel_is_data_only_closure(HSQUIRRELVM vm, SQInteger idx);
+SQUIRREL_API SQRESULT godot_squirrel_eliminate_dead_functions(HSQUIRRELVM vm, SQInteger first_idx, SQInteger count, SQInteger keep_idx, void (*on_removed)(void *userdata, SQInteger closure, const SQChar *name, SQInteger line, SQInteger instructions), void *userdata);
+SQUIRREL_API SQRESULT godot_squirrel_get_closure_statistics(HSQUIRRELVM vm, SQInteger idx, SQInteger *functions, SQInteger *instructions, SQInteger *literals);
+SQUIRREL_API SQRESULT godot_squirrel_copy_heap(HSQUIRRELVM src, HSQUIRRELVM dst, SQBool (*copy_userdata)(HSQUIRRELVM src, HSQUIRRELVM dst, const HSQOBJECT *obj));
+SQUIRREL_API SQRESULT godot_squirrel_save_image(HSQUIRRELVM vm, SQWRITEFUNC write, SQUserPointer up, SQRESULT (*write_userdata)(HSQUIRRELVM vm, const HSQOBJECT *obj, SQWRITEFUNC write, SQUserPointer up));
+SQUIRREL_API SQRESULT godot_squirrel_load_image(HSQUIRRELVM vm, SQREADFUNC read, SQUserPointer up, SQRESULT (*read_userdata)(HSQUIRRELVM vm, SQREADFUNC read, SQUserPointer up), SQBool (*resolve_native)(HSQUIRRELVM vm, const SQChar *name, void *userdata), void *userdata);
+SQUIRREL_API SQRESULT godot_squirrel_heap_census(HSQUIRRELVM vm, void (*visit)(void *userdata, const HSQOBJECT *obj, SQInteger bytes), void *userdata);
+SQUIRREL_API SQRESULT godot_squirrel_walk_heap(HSQUIRRELVM vm, const HSQOBJECT *roots, SQInteger root_count, void (*visit)(void *userdata, const HSQOBJECT *obj, SQInteger bytes, SQInteger parent, const SQChar *kind, const HSQOBJECT *key), void *userdata);
+SQUIRREL_API SQRESULT godot_squirrel_shrink_stack(HSQUIRRELVM vm);
+SQUIRREL_API SQInteger godot_squirrel_get_stack_memory_usage(HSQUIRRELVM vm);
+SQUIRREL_API SQRESULT godot_squirrel_reset_thread(HSQUIRRELVM vm);
+SQUIRREL_API SQUnsignedInteger godot_squirrel_get_refcount(const HSQOBJECT *obj);
+SQUIRREL_API SQRESULT godot_squirrel_get_native_closure_info(HSQUIRRELVM vm, SQInteger idx, SQFUNCTION *func, SQInteger *nparamscheck, const SQInteger **typemasks, SQInteger *typemask_count);
+SQUIRREL_API SQRESULT godot_squirrel_set_native_closure_paramscheck(HSQUIRRELVM vm, SQInteger idx, SQInteger nparamscheck, const SQInteger *typemasks, SQInteger typemask_count);
+SQUIRREL_API void godot_squirrel_set_native_debug_hook(HSQUIRRELVM vm, SQDEBUGHOOK hook);
+SQUIRREL_API SQBool godot_squirrel_throw_from_debug_hook(HSQUIRRELVM vm, const SQChar *error);
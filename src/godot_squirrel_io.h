@@ -0,0 +1,64 @@
+#pragma once
+
+#include <godot_cpp/core/error_macros.hpp>
+#include <godot_cpp/variant/packed_byte_array.hpp>
+
+#include <squirrel.h>
+
+#include <cstring>
+
+// SQREADFUNC/SQWRITEFUNC adapters for bytecode and heap images
+
+// reads directly from borrowed memory; the caller must keep the buffer alive
+// (and unmodified) until the read is done.
+struct SquirrelByteCodeReader {
+	const uint8_t *data = nullptr;
+	SQInteger size = 0;
+	SQInteger offset = 0;
+
+	static SQInteger read(SQUserPointer p_reader, SQUserPointer p_data, SQInteger p_count) {
+		SquirrelByteCodeReader *reader = reinterpret_cast<SquirrelByteCodeReader *>(p_reader);
+
+		const SQInteger count = MIN(reader->size - reader->offset, p_count);
+		DEV_ASSERT(count >= 0);
+
+		memcpy(p_data, reader->data + reader->offset, count);
+		reader->offset += count;
+
+		return count;
+	}
+};
+
+// sq_writeclosure emits many small chunks, so the buffer grows geometrically
+// and is only trimmed to its final size once serialization is done.
+struct SquirrelByteCodeWriter {
+	godot::PackedByteArray buffer;
+	int64_t size = 0;
+
+	static SQInteger write(SQUserPointer p_writer, SQUserPointer p_data, SQInteger p_count) {
+		DEV_ASSERT(p_count >= 0);
+
+		SquirrelByteCodeWriter *writer = reinterpret_cast<SquirrelByteCodeWriter *>(p_writer);
+
+		const int64_t required = writer->size + p_count;
+		if (unlikely(required > writer->buffer.size())) {
+			int64_t capacity = MAX(writer->buffer.size(), int64_t(256));
+			while (capacity < required) {
+				capacity *= 2;
+			}
+			if (unlikely(writer->buffer.resize(capacity) != godot::OK)) {
+				return -1;
+			}
+		}
+
+		memcpy(writer->buffer.ptrw() + writer->size, p_data, p_count);
+		writer->size = required;
+
+		return p_count;
+	}
+
+	godot::PackedByteArray finish() {
+		buffer.resize(size);
+		return buffer;
+	}
+};
@@ -1,15 +1,107 @@
 #include "../squirrel/squirrel/sqpcheader.h"
 
+#include "godot_squirrel_memory.h"
+
+#include <godot_cpp/core/error_macros.hpp>
 #include <godot_cpp/core/memory.hpp>
 
+
+thread_local SquirrelMemoryAccount *squirrel_current_memory_account = nullptr;
+thread_local void *squirrel_current_memory_context = nullptr;
+
+// every block starts with a header recording its requested size and the
+// account it was charged to, so it can be freed on any thread without a lookup.
+namespace {
+struct alignas(16) BlockHeader {
+	SquirrelMemoryAccount *account;
+	SQUnsignedInteger size;
+};
+static_assert(sizeof(BlockHeader) == 16, "block header must preserve 16-byte alignment");
+
+_FORCE_INLINE_ BlockHeader *get_header(void *p) {
+	return reinterpret_cast<BlockHeader *>(p) - 1;
+}
+
+_FORCE_INLINE_ void sample(SquirrelMemoryAccount *p_account, SQUnsignedInteger p_size) {
+	if (likely(p_account->sample_interval <= 0)) {
+		return;
+	}
+
+	p_account->sample_countdown -= int64_t(p_size);
+	if (p_account->sample_countdown <= 0) {
+		const int64_t samples = 1 + -p_account->sample_countdown / p_account->sample_interval;
+		p_account->sample_countdown += samples * p_account->sample_interval;
+		p_account->on_sample(p_account->sample_userdata, squirrel_current_memory_context, samples * p_account->sample_interval);
+	}
+}
+
+_FORCE_INLINE_ void charge(BlockHeader *p_header, SQUnsignedInteger p_size) {
+	p_header->account = squirrel_current_memory_account;
+	p_header->size = p_size;
+	if (p_header->account != nullptr) {
+		p_header->account->usage += int64_t(p_size);
+		sample(p_header->account, p_size);
+	}
+}
+
+// only growth counts towards sampling, as the rest was sampled when first allocated.
+// must run before the block is resized: the sampler walks the VM's call stack,
+// which may be the very block that is moving.
+_FORCE_INLINE_ void sample_growth(const BlockHeader *p_header, SQUnsignedInteger p_size) {
+	if (p_header->account != nullptr && p_size > p_header->size) {
+		sample(p_header->account, p_size - p_header->size);
+	}
+}
+
+_FORCE_INLINE_ void recharge(BlockHeader *p_header, SQUnsignedInteger p_size) {
+	if (p_header->account != nullptr) {
+		p_header->account->usage += int64_t(p_size) - int64_t(p_header->size);
+	}
+	p_header->size = p_size;
+}
+
+_FORCE_INLINE_ void refund(BlockHeader *p_header) {
+	if (p_header->account != nullptr) {
+		p_header->account->usage -= int64_t(p_header->size);
+	}
+}
+} //namespace
+
 void *sq_vm_malloc(SQUnsignedInteger size) {
-	return memalloc(size);
+	BlockHeader *header = reinterpret_cast<BlockHeader *>(memalloc(sizeof(BlockHeader) + size));
+	if (unlikely(header == nullptr)) {
+		return nullptr;
+	}
+
+	charge(header, size);
+	return header + 1;
 }
 
 void *sq_vm_realloc(void *p, SQUnsignedInteger SQ_UNUSED_ARG(oldsize), SQUnsignedInteger size) {
-	return memrealloc(p, size);
+	if (p == nullptr) {
+		return sq_vm_malloc(size);
+	}
+
+	// the block keeps its original account even if a different VM resizes it
+	BlockHeader *header = get_header(p);
+	const SquirrelMemoryScope scope(header->account, squirrel_current_memory_context);
+	sample_growth(header, size);
+
+	BlockHeader *resized = reinterpret_cast<BlockHeader *>(memrealloc(header, sizeof(BlockHeader) + size));
+	if (unlikely(resized == nullptr)) {
+		return nullptr;
+	}
+
+	recharge(resized, size);
+	return resized + 1;
 }
 
 void sq_vm_free(void *p, SQUnsignedInteger SQ_UNUSED_ARG(size)) {
-	memfree(p);
+	if (unlikely(p == nullptr)) {
+		return;
+	}
+
+	BlockHeader *header = get_header(p);
+	refund(header);
+	memfree(header);
 }
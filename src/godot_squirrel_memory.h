@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+
+// live bytes allocated by one SquirrelVM and everything running inside it.
+// Squirrel's allocation hooks don't say which VM is allocating, so the account
+// is chosen by a thread-local scope that is set whenever a VM is entered. each
+// block remembers its account, so frees are charged correctly from anywhere.
+struct SquirrelMemoryAccount {
+	int64_t usage = 0;
+	int64_t limit = 0; // 0 means unlimited
+
+	// when sample_interval is positive, on_sample is called about once per
+	// sample_interval bytes allocated, with the bytes the sample stands for
+	int64_t sample_interval = 0;
+	int64_t sample_countdown = 0;
+	void (*on_sample)(void *p_userdata, void *p_context, int64_t p_bytes) = nullptr;
+	void *sample_userdata = nullptr;
+
+	[[nodiscard]] bool is_over_limit() const {
+		return limit > 0 && usage > limit;
+	}
+};
+
+extern thread_local SquirrelMemoryAccount *squirrel_current_memory_account;
+// the Squirrel thread being entered, if any; passed to on_sample
+extern thread_local void *squirrel_current_memory_context;
+
+class SquirrelMemoryScope {
+	SquirrelMemoryAccount *_previous;
+	void *_previous_context;
+
+public:
+	explicit SquirrelMemoryScope(SquirrelMemoryAccount *p_account, void *p_context = nullptr) :
+			_previous(squirrel_current_memory_account),
+			_previous_context(squirrel_current_memory_context) {
+		squirrel_current_memory_account = p_account;
+		squirrel_current_memory_context = p_context;
+	}
+
+	~SquirrelMemoryScope() {
+		squirrel_current_memory_account = _previous;
+		squirrel_current_memory_context = _previous_context;
+	}
+
+	SquirrelMemoryScope(const SquirrelMemoryScope &) = delete;
+	SquirrelMemoryScope &operator=(const SquirrelMemoryScope &) = delete;
+};
@@ -30,6 +30,7 @@ void initialize_squirrel_module(ModuleInitializationLevel p_level) {
 	}
 
 	GDREGISTER_CLASS(SquirrelScript);
+	GDREGISTER_CLASS(SquirrelScriptBundle);
 
 	GDREGISTER_ABSTRACT_CLASS(SquirrelVariant);
 	GDREGISTER_CLASS(SquirrelStackInfo);
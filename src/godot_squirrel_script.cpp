@@ -1,10 +1,19 @@
 #include "godot_squirrel_defs.h"
 
-#ifndef SQUIRREL_NO_IMPORTER
+#include <godot_cpp/classes/dir_access.hpp>
 #include <godot_cpp/classes/file_access.hpp>
+#include <godot_cpp/classes/os.hpp>
+#include <godot_cpp/classes/time.hpp>
+#include <godot_cpp/classes/worker_thread_pool.hpp>
+#include <godot_cpp/templates/hashfuncs.hpp>
+
+#ifndef SQUIRREL_NO_IMPORTER
 #include <godot_cpp/classes/resource_saver.hpp>
 #endif
 
+#include "godot_squirrel_internals.h"
+#include "godot_squirrel_io.h"
+
 #include <squirrel.h>
 
 using namespace godot;
@@ -18,6 +27,10 @@ void SquirrelScript::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("set_bytecode", "bytecode"), &SquirrelScript::set_bytecode);
 	ADD_PROPERTY(PropertyInfo(Variant::PACKED_BYTE_ARRAY, "bytecode"), "set_bytecode", "get_bytecode");
 
+	ClassDB::bind_method(D_METHOD("get_data"), &SquirrelScript::get_data);
+	ClassDB::bind_method(D_METHOD("set_data", "data"), &SquirrelScript::set_data);
+	ADD_PROPERTY(PropertyInfo(Variant::NIL, "data", PROPERTY_HINT_NONE, String(), PROPERTY_USAGE_DEFAULT | PROPERTY_USAGE_NIL_IS_VARIANT), "set_data", "get_data");
+
 	ClassDB::bind_method(D_METHOD("get_error_desc"), &SquirrelScript::get_error_desc);
 	ClassDB::bind_method(D_METHOD("get_error_source"), &SquirrelScript::get_error_source);
 	ClassDB::bind_method(D_METHOD("get_error_line"), &SquirrelScript::get_error_line);
@@ -33,7 +46,16 @@ void SquirrelScript::_bind_methods() {
 	ADD_PROPERTY(PropertyInfo(Variant::INT, "error_line", PROPERTY_HINT_NONE, String(), PROPERTY_USAGE_NONE), "set_error_line", "get_error_line");
 	ADD_PROPERTY(PropertyInfo(Variant::INT, "error_column", PROPERTY_HINT_NONE, String(), PROPERTY_USAGE_NONE), "set_error_column", "get_error_column");
 
-	ClassDB::bind_method(D_METHOD("compile", "debug_file_name"), &SquirrelScript::compile, DEFVAL(String()));
+	ClassDB::bind_method(D_METHOD("compile", "debug_file_name", "optimize", "debug_info"), &SquirrelScript::compile, DEFVAL(String()), DEFVAL(false), DEFVAL(true));
+	ClassDB::bind_static_method(get_class_static(), D_METHOD("compile_batch", "scripts", "optimize", "debug_info"), &SquirrelScript::compile_batch, DEFVAL(false), DEFVAL(true));
+	ClassDB::bind_method(D_METHOD("compile_cached", "debug_file_name"), &SquirrelScript::compile_cached, DEFVAL(String()));
+	ClassDB::bind_method(D_METHOD("get_compile_statistics"), &SquirrelScript::get_compile_statistics);
+	ClassDB::bind_method(D_METHOD("extract_data"), &SquirrelScript::extract_data);
+	ClassDB::bind_static_method(get_class_static(), D_METHOD("eliminate_dead_functions", "scripts", "keep"), &SquirrelScript::eliminate_dead_functions, DEFVAL(PackedStringArray()));
+
+	ClassDB::bind_static_method(get_class_static(), D_METHOD("set_bytecode_cache_dir", "dir"), &SquirrelScript::set_bytecode_cache_dir);
+	ClassDB::bind_static_method(get_class_static(), D_METHOD("get_bytecode_cache_dir"), &SquirrelScript::get_bytecode_cache_dir);
+	ClassDB::bind_static_method(get_class_static(), D_METHOD("clear_bytecode_cache"), &SquirrelScript::clear_bytecode_cache);
 }
 
 String SquirrelScript::get_source() const {
@@ -52,10 +74,20 @@ PackedByteArray SquirrelScript::get_bytecode() const {
 void SquirrelScript::set_bytecode(const PackedByteArray &p_bytecode) {
 	if (_bytecode != p_bytecode) {
 		_bytecode = p_bytecode;
+		// extracted data came from the previous bytecode
+		_data = Variant();
 		emit_changed();
 	}
 }
 
+Variant SquirrelScript::get_data() const {
+	return _data;
+}
+void SquirrelScript::set_data(const Variant &p_data) {
+	_data = p_data;
+	emit_changed();
+}
+
 godot::String SquirrelScript::get_error_desc() const {
 	return _error_desc;
 }
@@ -82,63 +114,684 @@ void SquirrelScript::set_error_column(int64_t p_error_column) {
 	_error_column = p_error_column;
 }
 
-static SQInteger write_bytecode(SQUserPointer buffer, SQUserPointer data, SQInteger size) {
-	DEV_ASSERT(size >= 0);
+struct SquirrelCompileResult {
+	PackedByteArray bytecode;
+	String error_desc;
+	String error_source;
+	int64_t error_line = -1;
+	int64_t error_column = -1;
+	Error error = OK;
+	uint64_t time_usec = 0;
+	uint64_t compile_usec = 0;
+	uint64_t optimize_usec = 0;
+	uint64_t serialize_usec = 0;
+	SQInteger instructions_before_optimization = 0;
+	SQInteger instructions = 0;
+	SQInteger literals = 0;
+	SQInteger functions = 0;
+};
+
+namespace {
+struct SquirrelCompileJob {
+	CharString source;
+	CharString file_name;
+	SquirrelCompileResult result;
+};
+
+struct SquirrelCompileBatch {
+	LocalVector<SquirrelCompileJob> jobs;
+	uint32_t task_count = 1;
+	bool optimize = false;
+	bool debug_info = true;
+};
+} //namespace
 
-	PackedByteArray &buf = *reinterpret_cast<PackedByteArray *>(buffer);
+static void on_compile_error(HSQUIRRELVM vm, const SQChar *desc, const SQChar *source, SQInteger line, SQInteger column) {
+	SquirrelCompileResult *result = reinterpret_cast<SquirrelCompileResult *>(sq_getsharedforeignptr(vm));
+	result->error_desc = String::utf8(desc);
+	result->error_source = String::utf8(source);
+	result->error_line = line;
+	result->error_column = column;
+}
 
-	const int64_t offset = buf.size();
-	buf.resize(offset + size);
+// opens a VM that is only used to run the compiler. the VM can be reused for
+// any number of scripts, but only by one thread at a time.
+static HSQUIRRELVM open_compiler_vm() {
+	HSQUIRRELVM vm = sq_open(SQUIRREL_INITIAL_STACK_SIZE);
+	if (vm == nullptr) {
+		return nullptr;
+	}
 
-	memcpy(buf.ptrw() + offset, data, size);
+	sq_setcompilererrorhandler(vm, &on_compile_error);
 
-	return size;
+	return vm;
 }
 
-static void on_compile_error(HSQUIRRELVM vm, const SQChar *desc, const SQChar *source, SQInteger line, SQInteger column) {
-	SquirrelScript *script = reinterpret_cast<SquirrelScript *>(sq_getsharedforeignptr(vm));
-	script->set_error_desc(desc);
-	script->set_error_source(source);
-	script->set_error_line(line);
-	script->set_error_column(column);
+static void compile_with_vm(HSQUIRRELVM vm, const CharString &p_source, const CharString &p_file_name, bool p_optimize, bool p_debug_info, SquirrelCompileResult &r_result) {
+	Time *time = Time::get_singleton();
+	const uint64_t start = time->get_ticks_usec();
+
+	r_result = SquirrelCompileResult();
+	sq_setsharedforeignptr(vm, &r_result);
+
+	// debug info only controls _OP_LINE instructions (used by the debug hook);
+	// line number tables for error messages are always generated.
+#ifndef SQUIRREL_NO_DEBUG
+	sq_enabledebuginfo(vm, p_debug_info ? SQTrue : SQFalse);
+#else
+	sq_enabledebuginfo(vm, SQFalse);
+#endif
+
+#ifdef SQUIRREL_NO_COMPILER
+	r_result.error = ERR_UNAVAILABLE;
+	r_result.error_desc = "the Squirrel compiler is not included in this build";
+	r_result.error_source = String::utf8(p_file_name.get_data());
+#else
+	r_result.error = FAILED;
+	// lexing, parsing and code generation happen in a single pass, so they are timed together
+	const bool compiled = SQ_SUCCEEDED(sq_compilebuffer(vm, p_source, p_source.length(), p_file_name, SQTrue));
+	uint64_t now = time->get_ticks_usec();
+	r_result.compile_usec = now - start;
+
+	if (compiled) {
+		if (p_optimize) {
+			godot_squirrel_optimize_closure(vm, -1, &r_result.instructions_before_optimization, &r_result.instructions);
+
+			const uint64_t optimized = time->get_ticks_usec();
+			r_result.optimize_usec = optimized - now;
+			now = optimized;
+		}
+
+		godot_squirrel_get_closure_statistics(vm, -1, &r_result.functions, &r_result.instructions, &r_result.literals);
+		if (!p_optimize) {
+			r_result.instructions_before_optimization = r_result.instructions;
+		}
+
+		SquirrelByteCodeWriter writer;
+		if (SQ_SUCCEEDED(sq_writeclosure(vm, &SquirrelByteCodeWriter::write, &writer))) {
+			r_result.bytecode = writer.finish();
+			r_result.error = OK;
+		}
+		sq_poptop(vm);
+
+		r_result.serialize_usec = time->get_ticks_usec() - now;
+	}
+#endif
+
+	sq_setsharedforeignptr(vm, nullptr);
+
+	r_result.time_usec = time->get_ticks_usec() - start;
 }
 
-Error SquirrelScript::compile(const String &p_debug_file_name) {
-	HSQUIRRELVM vm = sq_open(SQUIRREL_INITIAL_STACK_SIZE);
+static void compile_batch_task(void *p_userdata, uint32_t p_index) {
+	SquirrelCompileBatch *batch = reinterpret_cast<SquirrelCompileBatch *>(p_userdata);
+
+	HSQUIRRELVM vm = open_compiler_vm();
+	for (uint32_t i = p_index; i < batch->jobs.size(); i += batch->task_count) {
+		SquirrelCompileJob &job = batch->jobs[i];
+		if (unlikely(vm == nullptr)) {
+			job.result.error = ERR_OUT_OF_MEMORY;
+			continue;
+		}
+
+		compile_with_vm(vm, job.source, job.file_name, batch->optimize, batch->debug_info, job.result);
+	}
+
+	if (vm != nullptr) {
+		sq_close(vm);
+	}
+}
+
+void SquirrelScript::_apply_compile_result(const SquirrelCompileResult &p_result) {
+	_error_desc = p_result.error_desc;
+	_error_source = p_result.error_source;
+	_error_line = p_result.error_line;
+	_error_column = p_result.error_column;
+
+	_compile_statistics = Dictionary();
+	_compile_statistics["time_usec"] = p_result.time_usec;
+	_compile_statistics["compile_usec"] = p_result.compile_usec;
+	_compile_statistics["optimize_usec"] = p_result.optimize_usec;
+	_compile_statistics["serialize_usec"] = p_result.serialize_usec;
+	_compile_statistics["functions"] = p_result.functions;
+	_compile_statistics["instructions"] = p_result.instructions;
+	_compile_statistics["instructions_before_optimization"] = p_result.instructions_before_optimization;
+	_compile_statistics["literals"] = p_result.literals;
+	_compile_statistics["bytecode_size"] = p_result.bytecode.size();
+
+	if (p_result.error == OK) {
+		set_bytecode(p_result.bytecode);
+	}
+}
+
+Error SquirrelScript::_compile(const String &p_debug_file_name, bool p_optimize, bool p_debug_info, SquirrelCompileResult &r_result) {
+	HSQUIRRELVM vm = open_compiler_vm();
 	if (vm == nullptr) {
 		return ERR_OUT_OF_MEMORY;
 	}
 
+	const String file_name = p_debug_file_name.is_empty() ? get_name() : p_debug_file_name;
+
+	compile_with_vm(vm, _source.utf8(), file_name.utf8(), p_optimize, p_debug_info, r_result);
+
+	sq_close(vm);
+
+	_apply_compile_result(r_result);
+
+	return r_result.error;
+}
+
+Error SquirrelScript::compile(const String &p_debug_file_name, bool p_optimize, bool p_debug_info) {
+	SquirrelCompileResult result;
+	return _compile(p_debug_file_name, p_optimize, p_debug_info, result);
+}
+
+TypedArray<Dictionary> SquirrelScript::compile_batch(const TypedArray<SquirrelScript> &p_scripts, bool p_optimize, bool p_debug_info) {
+	SquirrelCompileBatch batch;
+	batch.optimize = p_optimize;
+	batch.debug_info = p_debug_info;
+	batch.jobs.resize(p_scripts.size());
+	for (int64_t i = 0; i < p_scripts.size(); i++) {
+		const Ref<SquirrelScript> script = p_scripts[i];
+		ERR_FAIL_COND_V(script.is_null(), TypedArray<Dictionary>());
+
+		// strings are converted up front so worker threads never touch the resources
+		batch.jobs[i].source = script->_source.utf8();
+		batch.jobs[i].file_name = script->get_name().utf8();
+	}
+
+	if (!batch.jobs.is_empty()) {
+		batch.task_count = CLAMP(uint32_t(OS::get_singleton()->get_processor_count()), 1u, batch.jobs.size());
+
+		WorkerThreadPool *pool = WorkerThreadPool::get_singleton();
+		const int64_t group_id = pool->add_native_group_task(&compile_batch_task, &batch, batch.task_count, batch.task_count, true, "Squirrel compile_batch");
+		pool->wait_for_group_task_completion(group_id);
+	}
+
+	TypedArray<Dictionary> results;
+	results.resize(batch.jobs.size());
+	for (int64_t i = 0; i < p_scripts.size(); i++) {
+		const SquirrelCompileResult &result = batch.jobs[i].result;
+
+		const Ref<SquirrelScript> script = p_scripts[i];
+		script->_apply_compile_result(result);
+
+		Dictionary info;
+		info["error"] = result.error;
+		info["error_desc"] = result.error_desc;
+		info["error_source"] = result.error_source;
+		info["error_line"] = result.error_line;
+		info["error_column"] = result.error_column;
+		info["time_usec"] = result.time_usec;
+		results[i] = info;
+	}
+
+	return results;
+}
+
+// only the types that can appear in a data-only script's result are handled
+static bool read_data_value(HSQUIRRELVM vm, SQInteger p_index, Variant &r_value) {
+	switch (sq_gettype(vm, p_index)) {
+		case OT_NULL:
+			r_value = Variant();
+			return true;
+		case OT_BOOL: {
+			SQBool value = SQFalse;
+			sq_getbool(vm, p_index, &value);
+			r_value = value != SQFalse;
+			return true;
+		}
+		case OT_INTEGER: {
+			SQInteger value = 0;
+			sq_getinteger(vm, p_index, &value);
+			r_value = static_cast<int64_t>(value);
+			return true;
+		}
+		case OT_FLOAT: {
+			SQFloat value = 0;
+			sq_getfloat(vm, p_index, &value);
+			r_value = static_cast<double>(value);
+			return true;
+		}
+		case OT_STRING: {
+			const SQChar *string_chars = nullptr;
+			SQInteger string_size = 0;
+			sq_getstringandsize(vm, p_index, &string_chars, &string_size);
+			r_value = String::utf8(string_chars, string_size);
+			return true;
+		}
+		case OT_TABLE: {
+			Dictionary dict;
+			const SQInteger table = p_index < 0 ? sq_gettop(vm) + p_index + 1 : p_index;
+			sq_pushnull(vm);
+			while (SQ_SUCCEEDED(sq_next(vm, table))) {
+				Variant key;
+				Variant value;
+				if (unlikely(!read_data_value(vm, -2, key) || !read_data_value(vm, -1, value))) {
+					sq_pop(vm, 3);
+					return false;
+				}
+				dict[key] = value;
+				sq_pop(vm, 2);
+			}
+			sq_poptop(vm);
+			r_value = dict;
+			return true;
+		}
+		case OT_ARRAY: {
+			Array array;
+			array.resize(sq_getsize(vm, p_index));
+			const SQInteger squirrel_array = p_index < 0 ? sq_gettop(vm) + p_index + 1 : p_index;
+			for (int64_t i = 0; i < array.size(); i++) {
+				sq_pushinteger(vm, i);
+				if (unlikely(SQ_FAILED(sq_rawget(vm, squirrel_array)))) {
+					return false;
+				}
+				Variant value;
+				const bool ok = read_data_value(vm, -1, value);
+				sq_poptop(vm);
+				if (unlikely(!ok)) {
+					return false;
+				}
+				array[i] = value;
+			}
+			r_value = array;
+			return true;
+		}
+		default:
+			return false;
+	}
+}
+
+Dictionary SquirrelScript::get_compile_statistics() const {
+	return _compile_statistics;
+}
+
+bool SquirrelScript::extract_data() {
+	ERR_FAIL_COND_V_MSG(_bytecode.is_empty(), false, "Squirrel script must be compiled before data can be extracted");
+
+	HSQUIRRELVM vm = open_compiler_vm();
+	ERR_FAIL_NULL_V(vm, false);
+
+	Variant data;
+	SquirrelByteCodeReader reader{ .data = _bytecode.ptr(), .size = _bytecode.size() };
+	if (SQ_SUCCEEDED(sq_readclosure(vm, &SquirrelByteCodeReader::read, &reader))) {
+		// only run the script if it cannot have any side effects
+		if (godot_squirrel_is_data_only_closure(vm, -1)) {
+			sq_pushroottable(vm);
+			if (SQ_SUCCEEDED(sq_call(vm, 1, SQTrue, SQFalse))) {
+				const SQObjectType type = sq_gettype(vm, -1);
+				if ((type == OT_TABLE || type == OT_ARRAY) && !read_data_value(vm, -1, data)) {
+					data = Variant();
+				}
+				sq_poptop(vm);
+			}
+		}
+		sq_poptop(vm);
+	}
+
+	sq_close(vm);
+
+	set_data(data);
+
+	return data.get_type() != Variant::NIL;
+}
+
+static void on_dead_function_removed(void *p_userdata, SQInteger p_closure, const SQChar *p_name, SQInteger p_line, SQInteger p_instructions) {
+	Array &removed = *reinterpret_cast<Array *>(p_userdata);
+
+	Dictionary info;
+	info["script"] = p_closure;
+	info["name"] = String::utf8(p_name);
+	info["line"] = p_line;
+	info["instructions"] = p_instructions;
+	removed.push_back(info);
+}
+
+Dictionary SquirrelScript::eliminate_dead_functions(const TypedArray<SquirrelScript> &p_scripts, const PackedStringArray &p_keep) {
+	for (int64_t i = 0; i < p_scripts.size(); i++) {
+		const Ref<SquirrelScript> script = p_scripts[i];
+		ERR_FAIL_COND_V(script.is_null(), Dictionary());
+		ERR_FAIL_COND_V_MSG(script->_bytecode.is_empty(), Dictionary(), vformat("Squirrel script %s must be compiled before dead functions can be eliminated", script->get_name()));
+	}
+
+	HSQUIRRELVM vm = open_compiler_vm();
+	ERR_FAIL_NULL_V(vm, Dictionary());
+
+	int64_t size_before = 0;
+	for (int64_t i = 0; i < p_scripts.size(); i++) {
+		const Ref<SquirrelScript> script = p_scripts[i];
+		size_before += script->_bytecode.size();
+
+		SquirrelByteCodeReader reader{ .data = script->_bytecode.ptr(), .size = script->_bytecode.size() };
+		if (unlikely(SQ_FAILED(sq_readclosure(vm, &SquirrelByteCodeReader::read, &reader)))) {
+			sq_close(vm);
+			ERR_FAIL_V_MSG(Dictionary(), vformat("Squirrel bytecode parsing failed for %s", script->get_name()));
+		}
+	}
+
+	sq_newtableex(vm, p_keep.size());
+	for (int64_t i = 0; i < p_keep.size(); i++) {
+		const CharString name_bytes = p_keep[i].utf8();
+		sq_pushstring(vm, name_bytes, name_bytes.length());
+		sq_pushnull(vm);
+		sq_newslot(vm, -3, SQFalse);
+	}
+
+	Array removed;
+	const SQRESULT result = godot_squirrel_eliminate_dead_functions(vm, 1, p_scripts.size(), -1, &on_dead_function_removed, &removed);
+	sq_poptop(vm);
+
+	int64_t size_after = 0;
+	int64_t instructions_removed = 0;
+	TypedArray<SquirrelScript> scripts;
+	if (likely(SQ_SUCCEEDED(result))) {
+		for (int64_t i = 0; i < removed.size(); i++) {
+			Dictionary info = removed[i];
+			instructions_removed += int64_t(info["instructions"]);
+
+			// report scripts by name rather than by index
+			const Ref<SquirrelScript> script = p_scripts[int64_t(info["script"])];
+			info["script"] = script->get_name();
+		}
+
+		for (int64_t i = 0; i < p_scripts.size(); i++) {
+			SquirrelByteCodeWriter writer;
+			sq_push(vm, i + 1);
+			const bool written = SQ_SUCCEEDED(sq_writeclosure(vm, &SquirrelByteCodeWriter::write, &writer));
+			sq_poptop(vm);
+			if (unlikely(!written)) {
+				sq_close(vm);
+				ERR_FAIL_V_MSG(Dictionary(), "Squirrel bytecode serialization failed");
+			}
+
+			// the inputs are left untouched; callers decide whether to save the results over them
+			const Ref<SquirrelScript> script = p_scripts[i];
+			const Ref<SquirrelScript> result_script = script->duplicate();
+			result_script->set_bytecode(writer.finish());
+			scripts.push_back(result_script);
+			size_after += writer.size;
+		}
+	}
+
+	sq_close(vm);
+
+	ERR_FAIL_COND_V_MSG(SQ_FAILED(result), Dictionary(), "Squirrel dead function elimination failed");
+
+	Dictionary report;
+	report["scripts"] = scripts;
+	report["removed"] = removed;
+	report["instructions_removed"] = instructions_removed;
+	report["bytecode_size_before"] = size_before;
+	report["bytecode_size_after"] = size_after;
+
+	return report;
+}
+
+String SquirrelScript::_bytecode_cache_dir;
+
+static constexpr uint32_t BYTECODE_CACHE_MAGIC = 0x43425153; // "SQBC"
+static constexpr uint32_t BYTECODE_CACHE_FORMAT = 1;
+// entries live in this child of the configured directory, so nothing else in it is ever touched
+static constexpr const char *BYTECODE_CACHE_SUBDIR = "squirrel_bytecode";
+
+// anything that changes the serialized form of a closure must be part of this string
+static String bytecode_cache_build_key() {
 #ifndef SQUIRREL_NO_DEBUG
-	sq_enabledebuginfo(vm, SQTrue);
+	constexpr int debug_info = 1;
+#else
+	constexpr int debug_info = 0;
 #endif
-	sq_setsharedforeignptr(vm, this);
+	return vformat("%d-%d-i%d-f%d-d%d", BYTECODE_CACHE_FORMAT, SQUIRREL_VERSION_NUMBER, int(sizeof(SQInteger)), int(sizeof(SQFloat)), debug_info);
+}
 
-	_error_desc = String();
-	_error_source = String();
-	_error_line = -1;
-	_error_column = -1;
-	sq_setcompilererrorhandler(vm, &on_compile_error);
+static bool is_bytecode_cache_build_key(const String &p_name) {
+	const PackedStringArray parts = p_name.split("-");
+	return parts.size() == 5 && parts[0].is_valid_int() && parts[1].is_valid_int() && parts[2].begins_with("i") && parts[2].substr(1).is_valid_int() && parts[3].begins_with("f") && parts[3].substr(1).is_valid_int() && parts[4].begins_with("d") && parts[4].substr(1).is_valid_int();
+}
 
-	const CharString source_bytes = _source.utf8();
-	PackedByteArray bytecode;
+static String get_bytecode_cache_root(const String &p_dir) {
+	return p_dir.path_join(BYTECODE_CACHE_SUBDIR);
+}
+
+static void remove_dir_contents(const String &p_dir) {
+	for (const String &file : DirAccess::get_files_at(p_dir)) {
+		DirAccess::remove_absolute(p_dir.path_join(file));
+	}
+	for (const String &dir : DirAccess::get_directories_at(p_dir)) {
+		remove_dir_contents(p_dir.path_join(dir));
+		DirAccess::remove_absolute(p_dir.path_join(dir));
+	}
+}
+
+static PackedByteArray read_bytecode_cache_file(const String &p_path) {
+	const Ref<FileAccess> file = FileAccess::open(p_path, FileAccess::READ);
+	if (file.is_null()) {
+		return {};
+	}
+
+	if (file->get_32() != BYTECODE_CACHE_MAGIC || file->get_32() != BYTECODE_CACHE_FORMAT) {
+		return {};
+	}
+
+	const uint64_t size = file->get_64();
+	const uint32_t checksum = file->get_32();
+	if (size == 0 || size != file->get_length() - file->get_position()) {
+		return {};
+	}
+
+	PackedByteArray bytecode = file->get_buffer(size);
+	if (uint64_t(bytecode.size()) != size || hash_murmur3_buffer(bytecode.ptr(), bytecode.size()) != checksum) {
+		return {};
+	}
+
+	return bytecode;
+}
+
+static void write_bytecode_cache_file(const String &p_path, const PackedByteArray &p_bytecode) {
+	// write to a temporary file first so a concurrent reader never sees a partial entry.
+	// the name is unique per process, thread and write so concurrent writers don't collide.
+	static SafeNumeric<uint32_t> temp_file_sequence;
+	const String temp_path = vformat("%s.%d.%d.%d.tmp", p_path, OS::get_singleton()->get_process_id(), OS::get_singleton()->get_thread_caller_id(), temp_file_sequence.increment());
+
+	{
+		const Ref<FileAccess> file = FileAccess::open(temp_path, FileAccess::WRITE);
+		ERR_FAIL_COND_MSG(file.is_null(), vformat("Could not write Squirrel bytecode cache file %s", temp_path));
+
+		file->store_32(BYTECODE_CACHE_MAGIC);
+		file->store_32(BYTECODE_CACHE_FORMAT);
+		file->store_64(p_bytecode.size());
+		file->store_32(hash_murmur3_buffer(p_bytecode.ptr(), p_bytecode.size()));
+		file->store_buffer(p_bytecode);
+	}
+
+	if (DirAccess::rename_absolute(temp_path, p_path) != OK) {
+		DirAccess::remove_absolute(temp_path);
+	}
+}
+
+String SquirrelScript::_get_bytecode_cache_file(const String &p_file_name) const {
+	// the file name is embedded in the bytecode for error messages, so it is part of the key
+	const String key = vformat("%s\n%s", p_file_name, _source);
+	return get_bytecode_cache_root(_bytecode_cache_dir).path_join(bytecode_cache_build_key()).path_join(key.sha256_text() + ".sqbc");
+}
+
+Error SquirrelScript::compile_cached(const String &p_debug_file_name) {
+	if (_bytecode_cache_dir.is_empty()) {
+		return compile(p_debug_file_name);
+	}
 
 	const String file_name = p_debug_file_name.is_empty() ? get_name() : p_debug_file_name;
+	const String cache_file = _get_bytecode_cache_file(file_name);
 
-	bool succeeded = false;
-	if (SQ_SUCCEEDED(sq_compilebuffer(vm, source_bytes, source_bytes.length(), file_name.utf8(), SQTrue))) {
-		succeeded = SQ_SUCCEEDED(sq_writeclosure(vm, &write_bytecode, &bytecode));
-		sq_poptop(vm);
+	if (FileAccess::file_exists(cache_file)) {
+		const PackedByteArray bytecode = read_bytecode_cache_file(cache_file);
+		if (likely(!bytecode.is_empty())) {
+			_apply_compile_result(SquirrelCompileResult{ .bytecode = bytecode });
+			return OK;
+		}
+
+		// truncated or corrupt; recompile and replace it
+		DirAccess::remove_absolute(cache_file);
 	}
 
-	sq_close(vm);
+	const Error error = compile(file_name);
+	if (error == OK) {
+		write_bytecode_cache_file(cache_file, _bytecode);
+	}
+
+	return error;
+}
+
+void SquirrelScript::set_bytecode_cache_dir(const String &p_dir) {
+	_bytecode_cache_dir = p_dir;
+	if (p_dir.is_empty()) {
+		return;
+	}
+
+	const String root = get_bytecode_cache_root(p_dir);
+	const String build_key = bytecode_cache_build_key();
+	ERR_FAIL_COND_MSG(DirAccess::make_dir_recursive_absolute(root.path_join(build_key)) != OK, vformat("Could not create Squirrel bytecode cache directory %s", root));
+
+	// entries written by a different version or configuration can never be read again
+	for (const String &dir : DirAccess::get_directories_at(root)) {
+		if (dir != build_key && is_bytecode_cache_build_key(dir)) {
+			remove_dir_contents(root.path_join(dir));
+			DirAccess::remove_absolute(root.path_join(dir));
+		}
+	}
+}
+
+String SquirrelScript::get_bytecode_cache_dir() {
+	return _bytecode_cache_dir;
+}
+
+void SquirrelScript::clear_bytecode_cache() {
+	ERR_FAIL_COND_MSG(_bytecode_cache_dir.is_empty(), "The Squirrel bytecode cache is not enabled.");
+
+	remove_dir_contents(get_bytecode_cache_root(_bytecode_cache_dir).path_join(bytecode_cache_build_key()));
+}
+
+void SquirrelScriptBundle::_bind_methods() {
+	ClassDB::bind_method(D_METHOD("get_names"), &SquirrelScriptBundle::get_names);
+	ClassDB::bind_method(D_METHOD("set_names", "names"), &SquirrelScriptBundle::set_names);
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_STRING_ARRAY, "names", PROPERTY_HINT_NONE, String(), PROPERTY_USAGE_STORAGE), "set_names", "get_names");
+
+	ClassDB::bind_method(D_METHOD("get_offsets"), &SquirrelScriptBundle::get_offsets);
+	ClassDB::bind_method(D_METHOD("set_offsets", "offsets"), &SquirrelScriptBundle::set_offsets);
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_INT64_ARRAY, "offsets", PROPERTY_HINT_NONE, String(), PROPERTY_USAGE_STORAGE), "set_offsets", "get_offsets");
+
+	ClassDB::bind_method(D_METHOD("get_data"), &SquirrelScriptBundle::get_data);
+	ClassDB::bind_method(D_METHOD("set_data", "data"), &SquirrelScriptBundle::set_data);
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_BYTE_ARRAY, "data", PROPERTY_HINT_NONE, String(), PROPERTY_USAGE_STORAGE), "set_data", "get_data");
+
+	ClassDB::bind_method(D_METHOD("add_script", "name", "script"), &SquirrelScriptBundle::add_script);
+	ClassDB::bind_method(D_METHOD("has_script", "name"), &SquirrelScriptBundle::has_script);
+	ClassDB::bind_method(D_METHOD("get_bundled_script", "name"), &SquirrelScriptBundle::get_bundled_script);
+	ClassDB::bind_method(D_METHOD("get_script_count"), &SquirrelScriptBundle::get_script_count);
+	ClassDB::bind_method(D_METHOD("clear"), &SquirrelScriptBundle::clear);
+}
+
+void SquirrelScriptBundle::_rebuild_index() {
+	_index.clear();
+	for (int64_t i = 0; i < _names.size(); i++) {
+		_index[_names[i]] = i;
+	}
+}
+
+PackedStringArray SquirrelScriptBundle::get_names() const {
+	return _names;
+}
+void SquirrelScriptBundle::set_names(const PackedStringArray &p_names) {
+	_names = p_names;
+	_rebuild_index();
+	emit_changed();
+}
+PackedInt64Array SquirrelScriptBundle::get_offsets() const {
+	return _offsets;
+}
+void SquirrelScriptBundle::set_offsets(const PackedInt64Array &p_offsets) {
+	_offsets = p_offsets;
+	emit_changed();
+}
+PackedByteArray SquirrelScriptBundle::get_data() const {
+	return _data;
+}
+void SquirrelScriptBundle::set_data(const PackedByteArray &p_data) {
+	_data = p_data;
+	emit_changed();
+}
+
+Error SquirrelScriptBundle::add_script(const String &p_name, const Ref<SquirrelScript> &p_script) {
+	ERR_FAIL_COND_V(p_script.is_null(), ERR_INVALID_PARAMETER);
+	ERR_FAIL_COND_V_MSG(_index.has(p_name), ERR_ALREADY_EXISTS, vformat("Squirrel script bundle already contains %s", p_name));
+
+	const PackedByteArray bytecode = p_script->get_bytecode();
+	ERR_FAIL_COND_V_MSG(bytecode.is_empty(), ERR_INVALID_DATA, vformat("Squirrel script %s has not been compiled", p_name));
+
+	if (_offsets.is_empty()) {
+		_offsets.push_back(0);
+	}
+
+	_data.append_array(bytecode);
+	_offsets.push_back(_data.size());
+	_names.push_back(p_name);
+	_index[p_name] = _names.size() - 1;
+
+	emit_changed();
+
+	return OK;
+}
+
+bool SquirrelScriptBundle::has_script(const String &p_name) const {
+	return _index.has(p_name);
+}
+
+Ref<SquirrelScript> SquirrelScriptBundle::get_bundled_script(const String &p_name) const {
+	const uint8_t *data = nullptr;
+	int64_t size = 0;
+	ERR_FAIL_COND_V_MSG(!get_bytecode_range(p_name, data, size), Ref<SquirrelScript>(), vformat("Squirrel script bundle does not contain %s", p_name));
+
+	PackedByteArray bytecode;
+	bytecode.resize(size);
+	memcpy(bytecode.ptrw(), data, size);
+
+	Ref<SquirrelScript> script{ memnew(SquirrelScript) };
+	script->set_name(p_name);
+	script->set_bytecode(bytecode);
+
+	return script;
+}
+
+int64_t SquirrelScriptBundle::get_script_count() const {
+	return _names.size();
+}
+
+void SquirrelScriptBundle::clear() {
+	_names.clear();
+	_offsets.clear();
+	_data.clear();
+	_index.clear();
 
-	if (succeeded) {
-		set_bytecode(bytecode);
-		return OK;
+	emit_changed();
+}
+
+bool SquirrelScriptBundle::get_bytecode_range(const String &p_name, const uint8_t *&r_data, int64_t &r_size) const {
+	const auto it = _index.find(p_name);
+	if (it == _index.end()) {
+		return false;
 	}
 
-	return FAILED;
+	ERR_FAIL_COND_V_MSG(_offsets.size() != _names.size() + 1, false, "Squirrel script bundle index is corrupt");
+
+	const int64_t start = _offsets[it->value];
+	const int64_t end = _offsets[it->value + 1];
+	ERR_FAIL_COND_V_MSG(start < 0 || end < start || end > _data.size(), false, "Squirrel script bundle index is corrupt");
+
+	r_data = _data.ptr() + start;
+	r_size = end - start;
+
+	return true;
 }
 
 #ifndef SQUIRREL_NO_IMPORTER
@@ -174,7 +827,19 @@ TypedArray<Dictionary> SquirrelEditorImportPlugin::_get_import_options(const Str
 		option_clear_source["name"] = "clear_source";
 		option_clear_source["default_value"] = false;
 
-		return Array::make(option_compile, option_clear_source);
+		Dictionary option_optimize;
+		option_optimize["name"] = "optimize";
+		option_optimize["default_value"] = false;
+
+		Dictionary option_strip_debug_info;
+		option_strip_debug_info["name"] = "strip_debug_info";
+		option_strip_debug_info["default_value"] = false;
+
+		Dictionary option_extract_data;
+		option_extract_data["name"] = "extract_data";
+		option_extract_data["default_value"] = false;
+
+		return Array::make(option_compile, option_clear_source, option_optimize, option_strip_debug_info, option_extract_data);
 	}
 
 	return {};
@@ -195,7 +860,7 @@ int32_t SquirrelEditorImportPlugin::_get_format_version() const {
 	return SQUIRREL_VERSION_NUMBER;
 }
 bool SquirrelEditorImportPlugin::_get_option_visibility(const String &p_path, const StringName &p_option_name, const Dictionary &p_options) const {
-	if (p_option_name == StringName("clear_source")) {
+	if (p_option_name == StringName("clear_source") || p_option_name == StringName("optimize") || p_option_name == StringName("strip_debug_info") || p_option_name == StringName("extract_data")) {
 		return p_options.get("compile", false);
 	}
 
@@ -214,9 +879,19 @@ Error SquirrelEditorImportPlugin::_import(const String &p_source_file, const Str
 	script->set_name(p_source_file.get_file());
 	script->set_source(source_text);
 	if (p_options.get("compile", false)) {
-		Error error = script->compile(p_source_file);
+		const bool optimize = p_options.get("optimize", false);
+		SquirrelCompileResult result;
+		Error error = script->_compile(p_source_file, optimize, !p_options.get("strip_debug_info", false), result);
 		ERR_FAIL_COND_V_MSG(error != OK, error, vformat("Squirrel compile error: %s in %s:%d:%d", script->get_error_desc(), script->get_error_source(), script->get_error_line(), script->get_error_column()));
 
+		if (optimize) {
+			print_verbose(vformat("Squirrel optimizer: %s: %d -> %d instructions", p_source_file, result.instructions_before_optimization, result.instructions));
+		}
+
+		if (p_options.get("extract_data", false) && !script->extract_data()) {
+			print_verbose(vformat("Squirrel: %s does not only return a table or array literal; data was not extracted", p_source_file));
+		}
+
 		if (p_options.get("clear_source", false)) {
 			script->set_source(String());
 		}
@@ -1,12 +1,16 @@
 #include "godot_squirrel_defs.h"
 
+#include <godot_cpp/classes/time.hpp>
 #include <godot_cpp/templates/hash_map.hpp>
+#include <godot_cpp/variant/utility_functions.hpp>
 
 #ifndef SQUIRREL_NO_RANDOMNUMBERGENERATOR
 #include <godot_cpp/classes/random_number_generator.hpp>
 #endif
 
 #include "godot_squirrel_internals.h"
+#include "godot_squirrel_io.h"
+#include "godot_squirrel_memory.h"
 
 #include <sqstdaux.h>
 #include <sqstdblob.h>
@@ -25,15 +29,28 @@ struct SquirrelVariantUserData {
 
 	Variant variant;
 
+	// set when the value is interned, so the entry can be removed from the
+	// owning VM's intern table as soon as the userdata is released
+	void (*forget)(void *owner, SquirrelVariantUserData *svud) = nullptr;
+	void *owner = nullptr;
+	ObjectID object_id;
+	Variant key;
+	// the math library's generator; forked VMs get their own copy instead of
+	// sharing it (see copy_variant_userdata)
+	bool is_math_rng = false;
+
 	static SQInteger release_hook(SQUserPointer pointer, [[maybe_unused]] SQInteger size) {
 		SquirrelVariantUserData *svud = reinterpret_cast<SquirrelVariantUserData *>(pointer);
+		if (svud->forget != nullptr) {
+			svud->forget(svud->owner, svud);
+		}
 		svud->~SquirrelVariantUserData();
 
 		return 0;
 	}
 
 	// pushes a Variant to the top of the stack
-	static void create(HSQUIRRELVM vm, const Variant &variant) {
+	static SquirrelVariantUserData *create(HSQUIRRELVM vm, const Variant &variant) {
 		SQUserPointer pointer = sq_newuserdata(vm, sizeof(SquirrelVariantUserData));
 		SquirrelVariantUserData *svud = reinterpret_cast<SquirrelVariantUserData *>(pointer);
 		new (svud) SquirrelVariantUserData();
@@ -41,6 +58,7 @@ struct SquirrelVariantUserData {
 		sq_settypetag(vm, -1, type_tag);
 
 		svud->variant = variant;
+		return svud;
 	}
 
 	// retrieves a Variant from the stack
@@ -88,8 +106,129 @@ struct SquirrelVMBase::SquirrelVMInternal {
 		}
 	};
 	HashMap<HSQOBJECT, SquirrelVariant *, SQObjectHasher, SQObjectComparator> ref_objects;
-	HashMap<Variant, Ref<SquirrelWeakRef>, VariantHasher, VariantComparator> memoized_variants;
-	HashMap<ObjectID, Ref<SquirrelWeakRef>> memoized_objects;
+	// interned userdata is held weakly; each entry is erased by the release
+	// hook of its userdata (see forget_interned)
+	struct InternedVariant {
+		HSQOBJECT obj;
+		const SquirrelVariantUserData *svud;
+	};
+	HashMap<Variant, InternedVariant, VariantHasher, VariantComparator> memoized_variants;
+	HashMap<ObjectID, InternedVariant> memoized_objects;
+
+	SquirrelMemoryAccount memory;
+
+	// idle threads handed back by recycle_thread, each holding a reference,
+	// for create_thread to reuse
+	LocalVector<HSQOBJECT> thread_pool;
+	int64_t thread_pool_limit = SQUIRREL_THREAD_POOL_LIMIT;
+	int64_t thread_pool_hits = 0;
+	int64_t thread_pool_misses = 0;
+
+	void trim_thread_pool(int64_t p_size) {
+		while (int64_t(thread_pool.size()) > p_size) {
+			sq_release(vm, &thread_pool[thread_pool.size() - 1]);
+			thread_pool.resize(thread_pool.size() - 1);
+		}
+	}
+
+	// sampled allocations, keyed by the call stack that made them
+	struct AllocationSite {
+		int64_t samples = 0;
+		int64_t bytes = 0;
+	};
+	HashMap<String, AllocationSite> allocation_profile;
+
+	// Squirrel can't recover from a failed allocation, so the limit is checked
+	// at points where an error can be raised instead: calls between Godot and
+	// Squirrel, and between instructions through the debug hook
+	bool check_memory_limit() {
+		if (likely(!memory.is_over_limit())) {
+			return true;
+		}
+
+		collect_garbage(vm);
+		return !memory.is_over_limit();
+	}
+
+	// the collector can't be paused partway, so these record whole collections
+	struct GarbageCollectorStatistics {
+		int64_t collections = 0;
+		int64_t last_pause_usec = 0;
+		int64_t max_pause_usec = 0;
+		int64_t total_pause_usec = 0;
+		int64_t last_freed = 0;
+		int64_t total_freed = 0;
+		int64_t usage_before_last = 0;
+		int64_t usage_after_last = 0;
+	};
+	GarbageCollectorStatistics gc;
+	double gc_growth_ratio = 1.0;
+
+	int64_t collect_garbage(HSQUIRRELVM p_vm) {
+		const uint64_t start = Time::get_singleton()->get_ticks_usec();
+		const int64_t usage_before = memory.usage;
+
+		clean_prototype_cache();
+		const SQInteger freed = sq_collectgarbage(p_vm);
+
+		const int64_t pause = int64_t(Time::get_singleton()->get_ticks_usec() - start);
+		gc.collections++;
+		gc.last_pause_usec = pause;
+		gc.max_pause_usec = MAX(gc.max_pause_usec, pause);
+		gc.total_pause_usec += pause;
+		gc.last_freed = freed;
+		gc.total_freed += MAX(freed, SQInteger(0));
+		gc.usage_before_last = usage_before;
+		gc.usage_after_last = memory.usage;
+
+		return freed;
+	}
+
+	// function prototypes read by import(), keyed by the SquirrelScript they
+	// came from. holding a reference to the bytecode buffer means a matching
+	// pointer guarantees matching contents, as PackedByteArray is copy-on-write.
+	struct CachedPrototype {
+		PackedByteArray bytecode;
+		HSQOBJECT proto;
+	};
+	HashMap<ObjectID, CachedPrototype> prototype_cache;
+
+	void cache_prototype(ObjectID script_id, const PackedByteArray &bytecode, const HSQOBJECT &proto) {
+		uncache_prototype(script_id);
+
+		CachedPrototype &cached = prototype_cache[script_id];
+		cached.bytecode = bytecode;
+		cached.proto = proto;
+		sq_addref(vm, &cached.proto);
+	}
+
+	void uncache_prototype(ObjectID script_id) {
+		const auto cached = prototype_cache.find(script_id);
+		if (cached != prototype_cache.end()) {
+			sq_release(vm, &cached->value.proto);
+			prototype_cache.remove(cached);
+		}
+	}
+
+	void clear_prototype_cache() {
+		for (KeyValue<ObjectID, CachedPrototype> &cached : prototype_cache) {
+			sq_release(vm, &cached.value.proto);
+		}
+		prototype_cache.clear();
+	}
+
+	void clean_prototype_cache() {
+		LocalVector<ObjectID> unused;
+		for (const KeyValue<ObjectID, CachedPrototype> &cached : prototype_cache) {
+			if (unlikely(ObjectDB::get_instance(cached.key) == nullptr)) {
+				unused.push_back(cached.key);
+			}
+		}
+
+		for (ObjectID key : unused) {
+			uncache_prototype(key);
+		}
+	}
 
 	template <typename T>
 	Ref<T> make_ref_object(const HSQOBJECT &obj) {
@@ -103,38 +242,84 @@ struct SquirrelVMBase::SquirrelVMInternal {
 		return ref;
 	}
 
-	void clean_memoized_variants() {
-		LocalVector<Variant> unused;
-		LocalVector<ObjectID> unused_object;
-		do {
-			unused.clear();
-			unused_object.clear();
+	static void forget_interned(void *p_internal, SquirrelVariantUserData *p_svud) {
+		SquirrelVMInternal *internal = reinterpret_cast<SquirrelVMInternal *>(p_internal);
 
-			for (const KeyValue<Variant, Ref<SquirrelWeakRef>> &memo : memoized_variants) {
-				if (unlikely(!memo.value->is_valid())) {
-					unused.push_back(memo.key);
-				}
+		// the entry may already belong to a newer userdata for the same value
+		// if the table was cleared in between
+		if (p_svud->variant.get_type() == Variant::OBJECT) {
+			auto it = internal->memoized_objects.find(p_svud->object_id);
+			if (it != internal->memoized_objects.end() && it->value.svud == p_svud) {
+				internal->memoized_objects.erase(p_svud->object_id);
 			}
-
-			for (const KeyValue<ObjectID, Ref<SquirrelWeakRef>> &memo : memoized_objects) {
-				if (unlikely(!memo.value->is_valid())) {
-					unused_object.push_back(memo.key);
-				}
+		} else {
+			auto it = internal->memoized_variants.find(p_svud->key);
+			if (it != internal->memoized_variants.end() && it->value.svud == p_svud) {
+				internal->memoized_variants.erase(p_svud->key);
 			}
+		}
+	}
 
-			for (const Variant &key : unused) {
-				memoized_variants.erase(key);
-			}
+	// pushes the interned userdata for the value, creating it if needed
+	bool push_interned(HSQUIRRELVM p_vm, const Variant &p_value) {
+		const bool is_object = p_value.get_type() == Variant::OBJECT;
 
-			for (ObjectID key : unused_object) {
-				memoized_objects.erase(key);
+		const InternedVariant *interned = nullptr;
+		if (is_object) {
+			auto it = memoized_objects.find(p_value);
+			if (it != memoized_objects.end()) {
+				interned = &it->value;
 			}
-		} while (!unused.is_empty() || !unused_object.is_empty());
+		} else {
+			auto it = memoized_variants.find(p_value);
+			if (it != memoized_variants.end()) {
+				interned = &it->value;
+			}
+		}
+
+		if (interned != nullptr) {
+			sq_pushobject(p_vm, interned->obj);
+			return true;
+		}
+
+		SquirrelVariantUserData *svud = SquirrelVariantUserData::create(p_vm, p_value);
+		svud->forget = &forget_interned;
+		svud->owner = this;
+
+		InternedVariant entry;
+		entry.svud = svud;
+		ERR_FAIL_COND_V(SQ_FAILED(sq_getstackobj(p_vm, -1, &entry.obj)), false);
+
+		if (is_object) {
+			svud->object_id = p_value;
+			memoized_objects[svud->object_id] = entry;
+		} else {
+			// arrays and dictionaries share storage, so the caller could change the
+			// key's hash after the fact; the table keeps a private copy instead
+			const bool is_shared = p_value.get_type() == Variant::ARRAY || p_value.get_type() == Variant::DICTIONARY;
+			svud->key = is_shared ? p_value.duplicate(true) : p_value;
+			memoized_variants[svud->key] = entry;
+		}
+
+		return true;
 	}
 
-#ifndef SQUIRREL_NO_DEBUG
-	static void debug_hook(HSQUIRRELVM v, SQInteger type, const SQChar *sourcename, SQInteger line, const SQChar *funcname) {
+	// installed while debugging is enabled or a memory limit is set. the limit
+	// is checked on every line and call, so a script allocating in a loop is
+	// stopped even if it never calls into Godot.
+	static void debug_hook(HSQUIRRELVM v, SQInteger type, [[maybe_unused]] const SQChar *sourcename, [[maybe_unused]] SQInteger line, [[maybe_unused]] const SQChar *funcname) {
 		SquirrelVM *vm = reinterpret_cast<SquirrelVM *>(sq_getsharedforeignptr(v));
+
+		if ((type == 'l' || type == 'c') && unlikely(!vm->_vm_internal->check_memory_limit())) {
+			godot_squirrel_throw_from_debug_hook(v, "out of memory");
+			return;
+		}
+
+#ifndef SQUIRREL_NO_DEBUG
+		if (!vm->_debug_enabled) {
+			return;
+		}
+
 		Ref<SquirrelVMBase> vm_or_thread = vm;
 		if (vm->_vm_internal->vm != v) {
 			HSQOBJECT obj;
@@ -161,8 +346,12 @@ struct SquirrelVMBase::SquirrelVMInternal {
 #endif
 				break;
 		}
-	}
 #endif
+	}
+
+	void update_debug_hook(bool p_debug_enabled) {
+		godot_squirrel_set_native_debug_hook(vm, p_debug_enabled || memory.limit > 0 ? &debug_hook : nullptr);
+	}
 #ifndef SQUIRREL_NO_PRINT
 	static String squirrel_vsprintf(const char *format, va_list args) {
 		va_list args_copy;
@@ -207,6 +396,8 @@ struct SquirrelVMBase::SquirrelVMInternal {
 	}
 #endif
 	static SQInteger squirrel_callable_wrapper(HSQUIRRELVM vm);
+	static SQBool copy_variant_userdata(HSQUIRRELVM p_src, HSQUIRRELVM p_dst, const HSQOBJECT *p_obj);
+	static void record_allocation_sample(void *p_internal, void *p_context, int64_t p_bytes);
 };
 
 void SquirrelVariant::SquirrelVariantInternal::init(const Ref<SquirrelVM> &vm, SquirrelVariant *outer, const HSQOBJECT &init_obj) {
@@ -260,9 +451,12 @@ void SquirrelVMBase::_bind_methods() {
 
 	ClassDB::bind_method(D_METHOD("import", "script", "debug_file_name"), &SquirrelVMBase::import, DEFVAL(String()));
 	ClassDB::bind_method(D_METHOD("import_script", "script", "debug_file_name"), &SquirrelVMBase::import_script, DEFVAL(String()));
+	ClassDB::bind_method(D_METHOD("import_data", "script"), &SquirrelVMBase::import_data);
+	ClassDB::bind_method(D_METHOD("import_from_bundle", "bundle", "name"), &SquirrelVMBase::import_from_bundle);
 	ClassDB::bind_method(D_METHOD("import_blob"), &SquirrelVMBase::import_blob);
 	ClassDB::bind_method(D_METHOD("import_math"), &SquirrelVMBase::import_math);
 	ClassDB::bind_method(D_METHOD("import_string"), &SquirrelVMBase::import_string);
+	ClassDB::bind_method(D_METHOD("import_stdlib_lazy", "blob", "math", "string"), &SquirrelVMBase::import_stdlib_lazy, DEFVAL(true), DEFVAL(true), DEFVAL(true));
 	ClassDB::bind_vararg_method(METHOD_FLAG_VARARG, "call_function", &SquirrelVMBase::call_function, MethodInfo("call_function", PropertyInfo(Variant::OBJECT, "func", PROPERTY_HINT_RESOURCE_TYPE, SquirrelCallable::get_class_static()), PropertyInfo(Variant::NIL, "this", PROPERTY_HINT_NONE, String(), PROPERTY_USAGE_DEFAULT | PROPERTY_USAGE_NIL_IS_VARIANT)));
 	ClassDB::bind_method(D_METHOD("apply_function", "func", "this", "args"), &SquirrelVMBase::apply_function);
 	ClassDB::bind_method(D_METHOD("apply_function_catch", "func", "this", "args"), &SquirrelVMBase::apply_function_catch);
@@ -285,13 +479,15 @@ void SquirrelVMBase::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("create_table"), &SquirrelVMBase::create_table);
 	ClassDB::bind_method(D_METHOD("create_table_with_initial_capacity", "size"), &SquirrelVMBase::create_table_with_initial_capacity);
 	ClassDB::bind_method(D_METHOD("create_array", "size"), &SquirrelVMBase::create_array);
-	ClassDB::bind_method(D_METHOD("create_thread"), &SquirrelVMBase::create_thread);
+	ClassDB::bind_method(D_METHOD("create_thread", "stack_size"), &SquirrelVMBase::create_thread, DEFVAL(0));
 	ClassDB::bind_method(D_METHOD("wrap_variant", "value"), &SquirrelVMBase::wrap_variant);
 	ClassDB::bind_method(D_METHOD("intern_variant", "value"), &SquirrelVMBase::intern_variant);
 	ClassDB::bind_method(D_METHOD("wrap_callable", "callable", "varargs"), &SquirrelVMBase::wrap_callable, DEFVAL(false));
 	ClassDB::bind_method(D_METHOD("convert_variant", "value", "wrap_unhandled_values"), &SquirrelVMBase::convert_variant, DEFVAL(false));
 
 	ClassDB::bind_method(D_METHOD("collect_garbage"), &SquirrelVMBase::collect_garbage);
+	ClassDB::bind_method(D_METHOD("shrink_stack"), &SquirrelVMBase::shrink_stack);
+	ClassDB::bind_method(D_METHOD("get_stack_memory_usage"), &SquirrelVMBase::get_stack_memory_usage);
 	ClassDB::bind_method(D_METHOD("resurrect_unreachable"), &SquirrelVMBase::resurrect_unreachable);
 
 	ClassDB::bind_method(D_METHOD("set_error_handler", "func"), &SquirrelVMBase::set_error_handler);
@@ -318,6 +514,7 @@ void SquirrelVMBase::_bind_methods() {
 SquirrelVMBase::SquirrelVMBase(bool create) {
 	if (create) {
 		_vm_internal = memnew(SquirrelVMInternal);
+		const SquirrelMemoryScope memory_scope(&_vm_internal->memory);
 		_vm_internal->vm = sq_open(SQUIRREL_INITIAL_STACK_SIZE);
 		if (_vm_internal->vm == nullptr) {
 			ERR_PRINT("Failed to create Squirrel VM: out of memory?");
@@ -351,6 +548,8 @@ SquirrelVMBase::~SquirrelVMBase() {
 		_vm_internal->ref_objects.clear();
 		_vm_internal->memoized_variants.clear();
 		_vm_internal->memoized_objects.clear();
+		_vm_internal->clear_prototype_cache();
+		_vm_internal->trim_thread_pool(0);
 		sq_close(_vm_internal->vm);
 		memdelete(_vm_internal);
 	}
@@ -362,7 +561,14 @@ SquirrelVMBase::~SquirrelVMBase() {
 	} \
 	DEV_ASSERT(_vm_internal || sq_isthread(_internal->obj)); \
 	HSQUIRRELVM vm = likely(_vm_internal) ? _vm_internal->vm : _internal->obj._unVal.pThread; \
-	ERR_FAIL_NULL_V(vm, __VA_ARGS__)
+	ERR_FAIL_NULL_V(vm, __VA_ARGS__); \
+	const SquirrelMemoryScope memory_scope(&reinterpret_cast<SquirrelVM *>(sq_getsharedforeignptr(vm))->_vm_internal->memory, vm)
+
+// the SquirrelVariant counterpart of GET_VM, for values owned by a SquirrelVM
+#define GET_VARIANT_VM(...) \
+	SquirrelVM *vm = _get_vm(); \
+	ERR_FAIL_NULL_V(vm, __VA_ARGS__); \
+	const SquirrelMemoryScope memory_scope(&vm->_vm_internal->memory, vm->_vm_internal->vm)
 
 #define GET_OUTER_VM() \
 	DEV_ASSERT(vm); \
@@ -370,37 +576,37 @@ SquirrelVMBase::~SquirrelVMBase() {
 	DEV_ASSERT(outer_vm); \
 	DEV_ASSERT(outer_vm->_vm_internal)
 
-namespace {
-struct SquirrelByteCodeReader {
-	PackedByteArray bytes;
-	SQInteger offset = 0;
-
-	static SQInteger read(SQUserPointer p_reader, SQUserPointer p_data, SQInteger p_count) {
-		SquirrelByteCodeReader *reader = reinterpret_cast<SquirrelByteCodeReader *>(p_reader);
-
-		const SQInteger count = MIN(reader->bytes.size() - reader->offset, p_count);
-		DEV_ASSERT(count >= 0);
-
-		memcpy(p_data, reader->bytes.ptr() + reader->offset, count);
-		reader->offset += count;
-
-		return count;
-	}
-};
-} //namespace
-
 Ref<SquirrelFunction> SquirrelVMBase::import(const Ref<SquirrelScript> &p_script, const String &p_debug_file_name) {
 	ERR_FAIL_COND_V(p_script.is_null(), Ref<SquirrelFunction>());
 	GET_VM(Ref<SquirrelFunction>());
 	GET_OUTER_VM();
 
-	if (unlikely(p_script->get_bytecode().is_empty())) {
+	// PackedByteArray is copy-on-write, so this shares the resource's buffer rather than duplicating it
+	const PackedByteArray bytecode = p_script->get_bytecode();
+	if (unlikely(bytecode.is_empty())) {
+#ifdef SQUIRREL_NO_COMPILER
+		ERR_FAIL_V_MSG(Ref<SquirrelFunction>(), vformat("Squirrel script %s has not been compiled, and the Squirrel compiler is not included in this build", p_debug_file_name.is_empty() ? p_script->get_name() : p_debug_file_name));
+#else
 		const String file_name = p_debug_file_name.is_empty() ? p_script->get_name() : p_debug_file_name;
 		const CharString source_bytes = p_script->get_source().utf8();
 		ERR_FAIL_COND_V_MSG(SQ_FAILED(sq_compilebuffer(vm, source_bytes, source_bytes.length(), file_name.utf8(), SQTrue)), Ref<SquirrelFunction>(), "Squirrel script parsing failed");
+#endif
 	} else {
-		SquirrelByteCodeReader reader{ .bytes = p_script->get_bytecode() };
-		ERR_FAIL_COND_V_MSG(SQ_FAILED(sq_readclosure(vm, &SquirrelByteCodeReader::read, &reader)), Ref<SquirrelFunction>(), "Squirrel bytecode parsing failed");
+		const ObjectID script_id = p_script->get_instance_id();
+		const auto cached = outer_vm->_vm_internal->prototype_cache.find(script_id);
+		if (cached != outer_vm->_vm_internal->prototype_cache.end() && cached->value.bytecode.ptr() == bytecode.ptr() && cached->value.bytecode.size() == bytecode.size()) {
+			// already deserialized by this VM; only the closure needs to be allocated
+			ERR_FAIL_COND_V_MSG(SQ_FAILED(godot_squirrel_new_closure_from_proto(vm, &cached->value.proto)), Ref<SquirrelFunction>(), "Squirrel bytecode parsing failed");
+		} else {
+			SquirrelByteCodeReader reader{ .data = bytecode.ptr(), .size = bytecode.size() };
+			ERR_FAIL_COND_V_MSG(SQ_FAILED(sq_readclosure(vm, &SquirrelByteCodeReader::read, &reader)), Ref<SquirrelFunction>(), "Squirrel bytecode parsing failed");
+
+			HSQOBJECT proto;
+			sq_resetobject(&proto);
+			if (likely(SQ_SUCCEEDED(godot_squirrel_get_closure_proto(vm, -1, &proto)))) {
+				outer_vm->_vm_internal->cache_prototype(script_id, bytecode, proto);
+			}
+		}
 	}
 
 	HSQOBJECT obj;
@@ -418,15 +624,118 @@ Ref<SquirrelFunction> SquirrelVMBase::import_script(const String &p_script, cons
 	Ref<SquirrelScript> script{ memnew(SquirrelScript) };
 	script->set_source(p_script);
 
+	if (!SquirrelScript::get_bytecode_cache_dir().is_empty()) {
+		const Error error = script->compile_cached(p_debug_file_name);
+		ERR_FAIL_COND_V_MSG(error != OK, Ref<SquirrelFunction>(), vformat("Squirrel compile error: %s in %s:%d:%d", script->get_error_desc(), script->get_error_source(), script->get_error_line(), script->get_error_column()));
+	}
+
 	return import(script, p_debug_file_name);
 }
 
-void SquirrelVMBase::import_blob() {
-	GET_VM();
+// builds the value directly on the stack; tables and arrays are allocated at their final size
+static bool push_data_value(HSQUIRRELVM vm, const Variant &p_value) {
+	switch (p_value.get_type()) {
+		case Variant::NIL:
+			sq_pushnull(vm);
+			return true;
+		case Variant::BOOL:
+			sq_pushbool(vm, p_value.operator bool() ? SQTrue : SQFalse);
+			return true;
+		case Variant::INT:
+			sq_pushinteger(vm, static_cast<SQInteger>(p_value.operator int64_t()));
+			return true;
+		case Variant::FLOAT:
+			sq_pushfloat(vm, static_cast<SQFloat>(p_value.operator double()));
+			return true;
+		case Variant::STRING: {
+			const CharString string_bytes = p_value.operator String().utf8();
+			sq_pushstring(vm, string_bytes, string_bytes.length());
+			return true;
+		}
+		case Variant::DICTIONARY: {
+			const Dictionary dict = p_value;
+			const Array keys = dict.keys();
+			sq_newtableex(vm, keys.size());
+			for (int64_t i = 0; i < keys.size(); i++) {
+				if (unlikely(keys[i].get_type() == Variant::NIL || !push_data_value(vm, keys[i]))) {
+					sq_poptop(vm);
+					return false;
+				}
+				if (unlikely(!push_data_value(vm, dict[keys[i]]))) {
+					sq_pop(vm, 2);
+					return false;
+				}
+				if (unlikely(SQ_FAILED(sq_newslot(vm, -3, SQFalse)))) {
+					sq_poptop(vm);
+					return false;
+				}
+			}
+			return true;
+		}
+		case Variant::ARRAY: {
+			const Array array = p_value;
+			sq_newarray(vm, array.size());
+			for (int64_t i = 0; i < array.size(); i++) {
+				sq_pushinteger(vm, i);
+				if (unlikely(!push_data_value(vm, array[i]))) {
+					sq_pop(vm, 2);
+					return false;
+				}
+				if (unlikely(SQ_FAILED(sq_rawset(vm, -3)))) {
+					sq_poptop(vm);
+					return false;
+				}
+			}
+			return true;
+		}
+		default:
+			return false;
+	}
+}
 
-	sq_pushroottable(vm);
-	sqstd_register_bloblib(vm);
+Variant SquirrelVMBase::import_data(const Ref<SquirrelScript> &p_script) {
+	ERR_FAIL_COND_V(p_script.is_null(), nullptr);
+	GET_VM(nullptr);
+
+	const Variant data = p_script->get_data();
+	if (likely(data.get_type() == Variant::DICTIONARY || data.get_type() == Variant::ARRAY)) {
+		ERR_FAIL_COND_V_MSG(!push_data_value(vm, data), nullptr, vformat("Squirrel script %s contains data that cannot be converted to Squirrel values", p_script->get_name()));
+
+		const Variant result = get_stack(-1);
+		sq_poptop(vm);
+
+		return result;
+	}
+
+	// not extracted at import time; run the script normally
+	const Ref<SquirrelFunction> func = import(p_script);
+	ERR_FAIL_COND_V(func.is_null(), nullptr);
+
+	return apply_function(func, get_root_table(), Array());
+}
+
+Ref<SquirrelFunction> SquirrelVMBase::import_from_bundle(const Ref<SquirrelScriptBundle> &p_bundle, const String &p_name) {
+	ERR_FAIL_COND_V(p_bundle.is_null(), Ref<SquirrelFunction>());
+	GET_VM(Ref<SquirrelFunction>());
+	GET_OUTER_VM();
+
+	SquirrelByteCodeReader reader;
+	int64_t size = 0;
+	ERR_FAIL_COND_V_MSG(!p_bundle->get_bytecode_range(p_name, reader.data, size), Ref<SquirrelFunction>(), vformat("Squirrel script bundle does not contain %s", p_name));
+	reader.size = size;
+
+	// read directly out of the bundle's data; nothing else can modify the bundle while this runs
+	ERR_FAIL_COND_V_MSG(SQ_FAILED(sq_readclosure(vm, &SquirrelByteCodeReader::read, &reader)), Ref<SquirrelFunction>(), "Squirrel bytecode parsing failed");
+
+	HSQOBJECT obj;
+	sq_resetobject(&obj);
+	CRASH_COND_MSG(SQ_FAILED(sq_getstackobj(vm, -1, &obj)), "Failed to get closure from stack");
+	DEV_ASSERT(sq_isclosure(obj));
+
+	const Ref<SquirrelFunction> func = outer_vm->_vm_internal->make_ref_object<SquirrelFunction>(obj);
 	sq_poptop(vm);
+
+	return func;
 }
 
 #ifndef SQUIRREL_NO_RANDOMNUMBERGENERATOR
@@ -452,15 +761,10 @@ static SQInteger squirrel_math_srand(HSQUIRRELVM vm) {
 
 	return 0;
 }
-#endif
-
-void SquirrelVMBase::import_math() {
-	GET_VM();
 
-	sq_pushroottable(vm);
-	sqstd_register_mathlib(vm);
-
-#ifndef SQUIRREL_NO_RANDOMNUMBERGENERATOR
+// registers RAND_MAX, rand and srand into the table on top of the stack,
+// replacing the C library versions
+static void register_math_rng(HSQUIRRELVM vm) {
 	sq_pushstring(vm, "RAND_MAX", strlen("RAND_MAX"));
 	sq_pushinteger(vm, UINT32_MAX);
 	sq_newslot(vm, -3, SQFalse);
@@ -469,23 +773,318 @@ void SquirrelVMBase::import_math() {
 #ifndef SQUIRREL_RANDOMNUMBERGENERATOR_RANDOMSEED
 	rng->set_seed(0);
 #endif
-	Ref<SquirrelUserData> rng_ud = wrap_variant(rng);
+
+	// rand and srand share one userdata, so a forked VM copies it only once
+	HSQOBJECT rng_obj;
+	SquirrelVariantUserData::create(vm, rng)->is_math_rng = true;
+	sq_getstackobj(vm, -1, &rng_obj);
 
 	sq_pushstring(vm, "rand", -1);
-	sq_pushobject(vm, rng_ud->_internal->obj);
+	sq_pushobject(vm, rng_obj);
 	sq_newclosure(vm, &squirrel_math_rand, 1);
 	sq_setparamscheck(vm, 1, 1, nullptr);
 	sq_setnativeclosurename(vm, -1, "rand");
-	sq_newslot(vm, -3, SQFalse);
+	sq_newslot(vm, -4, SQFalse);
 
 	sq_pushstring(vm, "srand", -1);
-	sq_pushobject(vm, rng_ud->_internal->obj);
+	sq_pushobject(vm, rng_obj);
 	sq_newclosure(vm, &squirrel_math_srand, 1);
 	sq_setparamscheck(vm, 2, 2, ".n");
 	sq_setnativeclosurename(vm, -1, "srand");
-	sq_newslot(vm, -3, SQFalse);
+	sq_newslot(vm, -4, SQFalse);
+
+	sq_poptop(vm);
+}
 #endif
 
+// registers the math library into the table on top of the stack
+static void register_math(HSQUIRRELVM vm) {
+	sqstd_register_mathlib(vm);
+
+#ifndef SQUIRREL_NO_RANDOMNUMBERGENERATOR
+	register_math_rng(vm);
+#endif
+}
+
+namespace {
+enum SquirrelStdLib : SQInteger {
+	SQUIRREL_STDLIB_BLOB = 1 << 0,
+	SQUIRREL_STDLIB_MATH = 1 << 1,
+	SQUIRREL_STDLIB_STRING = 1 << 2,
+};
+
+// how import_stdlib_lazy creates one global of the standard library
+struct SquirrelStdLibEntry {
+	enum Kind {
+		FUNCTION, // a native closure without free variables
+		INTEGER,
+		FLOAT,
+		MATH_RNG, // rand and srand, which share a generator
+		LIBRARY, // anything else, such as a class, needs its whole library
+	};
+
+	Kind kind = LIBRARY;
+	SquirrelStdLib library = SQUIRREL_STDLIB_BLOB;
+	CharString name;
+	SQFUNCTION function = nullptr;
+	SQInteger nparamscheck = 0;
+	LocalVector<SQInteger> typemasks;
+	SQInteger integer = 0;
+	SQFloat real = 0;
+};
+
+struct SquirrelStdLibCatalog {
+	LocalVector<SquirrelStdLibEntry> entries;
+	HashMap<String, uint32_t> indices;
+};
+
+// which catalog entries a lazily imported root table has not created yet;
+// held by its delegate's _get
+struct SquirrelLazyStdLib {
+	static const SQUserPointer type_tag;
+
+	LocalVector<bool> pending;
+	int64_t remaining = 0;
+
+	static SQInteger release_hook(SQUserPointer pointer, [[maybe_unused]] SQInteger size) {
+		reinterpret_cast<SquirrelLazyStdLib *>(pointer)->~SquirrelLazyStdLib();
+		return 0;
+	}
+
+	// pushes new state to the top of the stack
+	static SquirrelLazyStdLib *create(HSQUIRRELVM vm) {
+		SquirrelLazyStdLib *lazy = reinterpret_cast<SquirrelLazyStdLib *>(sq_newuserdata(vm, sizeof(SquirrelLazyStdLib)));
+		new (lazy) SquirrelLazyStdLib();
+		sq_setreleasehook(vm, -1, &release_hook);
+		sq_settypetag(vm, -1, type_tag);
+		return lazy;
+	}
+
+	static SquirrelLazyStdLib *get(HSQUIRRELVM vm, SQInteger index) {
+		SQUserPointer pointer = nullptr;
+		SQUserPointer object_type_tag = nullptr;
+		if (SQ_FAILED(sq_getuserdata(vm, index, &pointer, &object_type_tag)) || object_type_tag != type_tag) {
+			return nullptr;
+		}
+		return reinterpret_cast<SquirrelLazyStdLib *>(pointer);
+	}
+
+	void mark_created(uint32_t p_index) {
+		if (pending[p_index]) {
+			pending[p_index] = false;
+			remaining--;
+		}
+	}
+};
+const SQUserPointer SquirrelLazyStdLib::type_tag = const_cast<SQUserPointer *>(&SquirrelLazyStdLib::type_tag); // NOLINT(bugprone-multi-level-implicit-pointer-conversion)
+} //namespace
+
+// registers the requested libraries into the table on top of the stack
+static void register_stdlib(HSQUIRRELVM vm, SQInteger p_libraries) {
+	if (p_libraries & SQUIRREL_STDLIB_BLOB) {
+		sqstd_register_bloblib(vm);
+	}
+	if (p_libraries & SQUIRREL_STDLIB_MATH) {
+		register_math(vm);
+	}
+	if (p_libraries & SQUIRREL_STDLIB_STRING) {
+		sqstd_register_stringlib(vm);
+	}
+}
+
+// records every global in the table on top of the stack; later entries
+// replace earlier ones with the same name
+static void add_stdlib_entries(HSQUIRRELVM vm, SquirrelStdLib p_library, SquirrelStdLibEntry::Kind p_fallback, SquirrelStdLibCatalog &r_catalog) {
+	sq_pushnull(vm);
+	while (SQ_SUCCEEDED(sq_next(vm, -2))) {
+		const SQChar *name = nullptr;
+		if (unlikely(SQ_FAILED(sq_getstring(vm, -2, &name)))) {
+			sq_pop(vm, 2);
+			continue;
+		}
+
+		SquirrelStdLibEntry entry;
+		entry.kind = p_fallback;
+		entry.library = p_library;
+		entry.name = name;
+
+		switch (sq_gettype(vm, -1)) {
+			case OT_NATIVECLOSURE: {
+				const SQInteger *typemasks = nullptr;
+				SQInteger typemask_count = 0;
+				if (SQ_SUCCEEDED(godot_squirrel_get_native_closure_info(vm, -1, &entry.function, &entry.nparamscheck, &typemasks, &typemask_count))) {
+					entry.kind = SquirrelStdLibEntry::FUNCTION;
+					for (SQInteger i = 0; i < typemask_count; i++) {
+						entry.typemasks.push_back(typemasks[i]);
+					}
+				}
+			} break;
+			case OT_INTEGER:
+				entry.kind = SquirrelStdLibEntry::INTEGER;
+				sq_getinteger(vm, -1, &entry.integer);
+				break;
+			case OT_FLOAT:
+				entry.kind = SquirrelStdLibEntry::FLOAT;
+				sq_getfloat(vm, -1, &entry.real);
+				break;
+			default:
+				break;
+		}
+
+		const String key = String::utf8(name);
+		const uint32_t *existing = r_catalog.indices.getptr(key);
+		if (existing != nullptr) {
+			r_catalog.entries[*existing] = entry;
+		} else {
+			r_catalog.indices[key] = r_catalog.entries.size();
+			r_catalog.entries.push_back(entry);
+		}
+
+		sq_pop(vm, 2);
+	}
+	sq_poptop(vm);
+}
+
+// the standard library's globals, read once per process from a scratch VM
+static SquirrelStdLibCatalog build_stdlib_catalog() {
+	SquirrelStdLibCatalog catalog;
+
+	// the scratch VM belongs to no SquirrelVM, so it isn't charged to one
+	const SquirrelMemoryScope memory_scope(nullptr);
+	HSQUIRRELVM vm = sq_open(SQUIRREL_INITIAL_STACK_SIZE);
+	ERR_FAIL_NULL_V(vm, catalog);
+
+	sq_newtable(vm);
+	sqstd_register_bloblib(vm);
+	add_stdlib_entries(vm, SQUIRREL_STDLIB_BLOB, SquirrelStdLibEntry::LIBRARY, catalog);
+	sq_poptop(vm);
+
+	sq_newtable(vm);
+	sqstd_register_mathlib(vm);
+	add_stdlib_entries(vm, SQUIRREL_STDLIB_MATH, SquirrelStdLibEntry::LIBRARY, catalog);
+	sq_poptop(vm);
+
+#ifndef SQUIRREL_NO_RANDOMNUMBERGENERATOR
+	sq_newtable(vm);
+	register_math_rng(vm);
+	add_stdlib_entries(vm, SQUIRREL_STDLIB_MATH, SquirrelStdLibEntry::MATH_RNG, catalog);
+	sq_poptop(vm);
+#endif
+
+	sq_newtable(vm);
+	sqstd_register_stringlib(vm);
+	add_stdlib_entries(vm, SQUIRREL_STDLIB_STRING, SquirrelStdLibEntry::LIBRARY, catalog);
+	sq_poptop(vm);
+
+	sq_close(vm);
+
+	return catalog;
+}
+
+static const SquirrelStdLibCatalog &get_stdlib_catalog() {
+	static const SquirrelStdLibCatalog catalog = build_stdlib_catalog();
+	return catalog;
+}
+
+// creates one global in the table on top of the stack
+static void create_stdlib_entry(HSQUIRRELVM vm, SquirrelLazyStdLib &r_lazy, uint32_t p_index) {
+	const SquirrelStdLibCatalog &catalog = get_stdlib_catalog();
+	const SquirrelStdLibEntry &entry = catalog.entries[p_index];
+
+	switch (entry.kind) {
+		case SquirrelStdLibEntry::FUNCTION:
+			sq_pushstring(vm, entry.name.get_data(), entry.name.length());
+			sq_newclosure(vm, entry.function, 0);
+			godot_squirrel_set_native_closure_paramscheck(vm, -1, entry.nparamscheck, entry.typemasks.ptr(), entry.typemasks.size());
+			sq_setnativeclosurename(vm, -1, entry.name.get_data());
+			sq_newslot(vm, -3, SQFalse);
+			r_lazy.mark_created(p_index);
+			return;
+		case SquirrelStdLibEntry::INTEGER:
+			sq_pushstring(vm, entry.name.get_data(), entry.name.length());
+			sq_pushinteger(vm, entry.integer);
+			sq_newslot(vm, -3, SQFalse);
+			r_lazy.mark_created(p_index);
+			return;
+		case SquirrelStdLibEntry::FLOAT:
+			sq_pushstring(vm, entry.name.get_data(), entry.name.length());
+			sq_pushfloat(vm, entry.real);
+			sq_newslot(vm, -3, SQFalse);
+			r_lazy.mark_created(p_index);
+			return;
+		default:
+			break;
+	}
+
+	// register into a scratch table and keep whatever is still missing, so
+	// globals the script already replaced are left alone
+	sq_newtable(vm);
+#ifndef SQUIRREL_NO_RANDOMNUMBERGENERATOR
+	if (entry.kind == SquirrelStdLibEntry::MATH_RNG) {
+		register_math_rng(vm);
+	} else {
+		register_stdlib(vm, entry.library);
+	}
+#else
+	register_stdlib(vm, entry.library);
+#endif
+
+	sq_pushnull(vm);
+	while (SQ_SUCCEEDED(sq_next(vm, -2))) {
+		// stack: table, scratch table, iterator, key, value
+		const SQChar *name = nullptr;
+		const uint32_t *index = SQ_SUCCEEDED(sq_getstring(vm, -2, &name)) ? catalog.indices.getptr(String::utf8(name)) : nullptr;
+		if (index != nullptr && r_lazy.pending[*index]) {
+			sq_newslot(vm, -5, SQFalse);
+			r_lazy.mark_created(*index);
+		} else {
+			sq_pop(vm, 2);
+		}
+	}
+	sq_pop(vm, 2);
+}
+
+// after libraries were imported eagerly into the root table on top of the
+// stack, its lazy delegate no longer has to create their globals
+static void finish_lazy_stdlib(HSQUIRRELVM vm, SQInteger p_libraries) {
+	const SQInteger top = sq_gettop(vm);
+
+	sq_getdelegate(vm, top);
+	sq_pushstring(vm, "_get", strlen("_get"));
+	if (sq_gettype(vm, -2) == OT_TABLE && SQ_SUCCEEDED(sq_rawget(vm, -2)) && sq_gettype(vm, -1) == OT_NATIVECLOSURE && sq_getfreevariable(vm, -1, 0) != nullptr) {
+		SquirrelLazyStdLib *lazy = SquirrelLazyStdLib::get(vm, -1);
+		if (lazy != nullptr) {
+			const SquirrelStdLibCatalog &catalog = get_stdlib_catalog();
+			for (uint32_t i = 0; i < catalog.entries.size(); i++) {
+				if (catalog.entries[i].library & p_libraries) {
+					lazy->mark_created(i);
+				}
+			}
+			if (lazy->remaining == 0) {
+				sq_pushnull(vm);
+				sq_setdelegate(vm, top);
+			}
+		}
+	}
+
+	sq_settop(vm, top);
+}
+
+void SquirrelVMBase::import_blob() {
+	GET_VM();
+
+	sq_pushroottable(vm);
+	sqstd_register_bloblib(vm);
+	finish_lazy_stdlib(vm, SQUIRREL_STDLIB_BLOB);
+	sq_poptop(vm);
+}
+
+void SquirrelVMBase::import_math() {
+	GET_VM();
+
+	sq_pushroottable(vm);
+	register_math(vm);
+	finish_lazy_stdlib(vm, SQUIRREL_STDLIB_MATH);
 	sq_poptop(vm);
 }
 
@@ -494,6 +1093,84 @@ void SquirrelVMBase::import_string() {
 
 	sq_pushroottable(vm);
 	sqstd_register_stringlib(vm);
+	finish_lazy_stdlib(vm, SQUIRREL_STDLIB_STRING);
+	sq_poptop(vm);
+}
+
+// _get for the root table's delegate: creates the missing global if it is
+// part of the selected libraries, and removes itself once all of them exist
+static SQInteger squirrel_lazy_stdlib_get(HSQUIRRELVM vm) {
+	// stack: table, key, state (free variable)
+	SquirrelLazyStdLib *lazy = SquirrelLazyStdLib::get(vm, 3);
+	CRASH_COND(lazy == nullptr);
+
+	const SQChar *name = nullptr;
+	const uint32_t *index = nullptr;
+	if (sq_gettype(vm, 2) == OT_STRING && SQ_SUCCEEDED(sq_getstring(vm, 2, &name))) {
+		index = get_stdlib_catalog().indices.getptr(String::utf8(name));
+	}
+
+	if (index == nullptr || !lazy->pending[*index]) {
+		// throwing null tells the VM the slot does not exist
+		sq_pushnull(vm);
+		return sq_throwobject(vm);
+	}
+
+	sq_push(vm, 1);
+	create_stdlib_entry(vm, *lazy, *index);
+	if (lazy->remaining == 0) {
+		sq_pushnull(vm);
+		sq_setdelegate(vm, -2);
+	}
+	sq_poptop(vm);
+
+	sq_push(vm, 2);
+	if (SQ_FAILED(sq_rawget(vm, 1))) {
+		sq_pushnull(vm);
+		return sq_throwobject(vm);
+	}
+
+	return 1;
+}
+
+void SquirrelVMBase::import_stdlib_lazy(bool p_blob, bool p_math, bool p_string) {
+	GET_VM();
+
+	const SQInteger libraries = (p_blob ? SQUIRREL_STDLIB_BLOB : 0) | (p_math ? SQUIRREL_STDLIB_MATH : 0) | (p_string ? SQUIRREL_STDLIB_STRING : 0);
+	if (libraries == 0) {
+		return;
+	}
+
+	const SquirrelStdLibCatalog &catalog = get_stdlib_catalog();
+
+	sq_pushroottable(vm);
+
+	// the root table's delegate belongs to the user; don't replace it
+	sq_getdelegate(vm, -1);
+	const bool has_delegate = sq_gettype(vm, -1) != OT_NULL;
+	sq_poptop(vm);
+	if (unlikely(has_delegate || catalog.entries.is_empty())) {
+		register_stdlib(vm, libraries);
+		sq_poptop(vm);
+		return;
+	}
+
+	sq_newtableex(vm, 1);
+	sq_pushstring(vm, "_get", strlen("_get"));
+
+	SquirrelLazyStdLib *lazy = SquirrelLazyStdLib::create(vm);
+	lazy->pending.resize(catalog.entries.size());
+	for (uint32_t i = 0; i < catalog.entries.size(); i++) {
+		lazy->pending[i] = (catalog.entries[i].library & libraries) != 0;
+		lazy->remaining += lazy->pending[i] ? 1 : 0;
+	}
+
+	sq_newclosure(vm, &squirrel_lazy_stdlib_get, 1);
+	sq_setparamscheck(vm, 2, 2, nullptr);
+	sq_setnativeclosurename(vm, -1, "_get");
+	sq_newslot(vm, -3, SQFalse);
+
+	ERR_FAIL_COND(SQ_FAILED(sq_setdelegate(vm, -2)));
 	sq_poptop(vm);
 }
 
@@ -507,6 +1184,8 @@ Variant SquirrelVMBase::call_function(const Variant **p_args, GDExtensionInt p_a
 	GET_VM(nullptr);
 	GET_OUTER_VM();
 
+	ERR_FAIL_COND_V_MSG(!outer_vm->_vm_internal->check_memory_limit(), nullptr, "Squirrel VM memory limit exceeded.");
+
 	sq_pushobject(vm, func->_internal->obj);
 	for (int arg = 1; arg < p_arg_count; arg++) {
 		if (unlikely(!push_stack(*p_args[arg]))) {
@@ -551,6 +1230,10 @@ Variant SquirrelVMBase::apply_function_catch(const Ref<SquirrelCallable> &p_func
 
 	ERR_FAIL_COND_V(sq_getvmstate(vm) == SQ_VMSTATE_SUSPENDED, SquirrelThrow::make("cannot start a function on a suspended VM (use wake_up)"));
 
+	if (unlikely(!outer_vm->_vm_internal->check_memory_limit())) {
+		return SquirrelThrow::make("out of memory");
+	}
+
 #ifdef DEBUG_ENABLED
 	const SQInteger top_before = sq_gettop(vm);
 #endif
@@ -868,11 +1551,29 @@ Ref<SquirrelArray> SquirrelVMBase::create_array(int64_t p_size) {
 	return array;
 }
 
-Ref<SquirrelThread> SquirrelVMBase::create_thread() {
+Ref<SquirrelThread> SquirrelVMBase::create_thread(int64_t p_stack_size) {
 	GET_VM(Ref<SquirrelThread>());
+	GET_OUTER_VM();
+	ERR_FAIL_COND_V(p_stack_size < 0, Ref<SquirrelThread>());
+
+	// pooled threads were shrunk when recycled, so only default-sized requests use them
+	LocalVector<HSQOBJECT> &pool = outer_vm->_vm_internal->thread_pool;
+	if (p_stack_size == 0 && !pool.is_empty()) {
+		HSQOBJECT pooled = pool[pool.size() - 1];
+		pool.resize(pool.size() - 1);
+		outer_vm->_vm_internal->thread_pool_hits++;
 
-	HSQUIRRELVM thread_vm = sq_newthread(vm, SQUIRREL_INITIAL_STACK_SIZE);
-	ERR_FAIL_NULL_V(thread_vm, Ref<SquirrelThread>());
+		sq_pushobject(vm, pooled);
+		sq_release(vm, &pooled);
+	} else {
+		if (p_stack_size == 0) {
+			outer_vm->_vm_internal->thread_pool_misses++;
+		}
+
+		const SQInteger stack_size = p_stack_size == 0 ? SQUIRREL_INITIAL_STACK_SIZE : MAX(SQInteger(p_stack_size), SQInteger(SQUIRREL_MIN_STACK_SIZE));
+		HSQUIRRELVM thread_vm = sq_newthread(vm, stack_size);
+		ERR_FAIL_NULL_V(thread_vm, Ref<SquirrelThread>());
+	}
 	const Ref<SquirrelThread> thread = get_stack(-1);
 	DEV_ASSERT(thread.is_valid());
 
@@ -898,39 +1599,25 @@ Ref<SquirrelUserData> SquirrelVMBase::intern_variant(const Variant &p_value) {
 	GET_VM(Ref<SquirrelUserData>());
 	GET_OUTER_VM();
 
-	if (p_value.get_type() == Variant::OBJECT) {
-		auto it = outer_vm->_vm_internal->memoized_objects.find(p_value);
-		if (it != outer_vm->_vm_internal->memoized_objects.end()) {
-			const Ref<SquirrelUserData> ud = it->value->get_object();
-			if (ud.is_valid()) {
-				return ud;
-			}
-		}
-
-		const Ref<SquirrelUserData> wrapped = wrap_variant(p_value);
-		outer_vm->_vm_internal->memoized_objects[p_value] = wrapped->weak_ref();
+	ERR_FAIL_COND_V(!outer_vm->_vm_internal->push_interned(vm, p_value), Ref<SquirrelUserData>());
 
-		return wrapped;
-	} else {
-		auto it = outer_vm->_vm_internal->memoized_variants.find(p_value);
-		if (it != outer_vm->_vm_internal->memoized_variants.end()) {
-			const Ref<SquirrelUserData> ud = it->value->get_object();
-			if (ud.is_valid()) {
-				return ud;
-			}
-		}
+	const Ref<SquirrelUserData> ud = get_stack(-1);
+	DEV_ASSERT(ud.is_valid());
 
-		const Ref<SquirrelUserData> wrapped = wrap_variant(p_value);
-		outer_vm->_vm_internal->memoized_variants[p_value] = wrapped->weak_ref();
+	sq_poptop(vm);
 
-		return wrapped;
-	}
+	return ud;
 }
 
 SQInteger SquirrelVMBase::SquirrelVMInternal::squirrel_callable_wrapper(HSQUIRRELVM vm) {
 	Ref<SquirrelVM> outer_vm = reinterpret_cast<SquirrelVM *>(sq_getsharedforeignptr(vm));
 	Ref<SquirrelVMBase> vm_base = outer_vm->_from_native_vm(vm);
 
+	// native calls are the only place a running script can be stopped safely
+	if (unlikely(!outer_vm->_vm_internal->check_memory_limit())) {
+		return sq_throwerror(vm, "out of memory");
+	}
+
 	SQBool varargs = SQFalse;
 	ERR_FAIL_COND_V(SQ_FAILED(sq_getbool(vm, -2, &varargs)), sq_throwerror(vm, "wrapped callable free variables invalid"));
 	Variant wrapped_func;
@@ -1001,6 +1688,31 @@ SQInteger SquirrelVMBase::SquirrelVMInternal::squirrel_callable_wrapper(HSQUIRRE
 	ERR_FAIL_V(sq_throwerror(vm, "wrapped callable returned non-Squirrel value"));
 }
 
+void SquirrelVMBase::SquirrelVMInternal::record_allocation_sample(void *p_internal, void *p_context, int64_t p_bytes) {
+	SquirrelVMInternal *internal = reinterpret_cast<SquirrelVMInternal *>(p_internal);
+	HSQUIRRELVM vm = reinterpret_cast<HSQUIRRELVM>(p_context);
+
+	// collapsed stack format: outermost frame first, frames separated by semicolons.
+	// this runs inside an allocation, so it must not touch the Squirrel heap.
+	LocalVector<String> frames;
+	SQStackInfos si;
+	for (SQInteger level = 0; vm != nullptr && level < 64 && SQ_SUCCEEDED(sq_stackinfos(vm, level, &si)); level++) {
+		frames.push_back(vformat("%s (%s:%d)", si.funcname ? String::utf8(si.funcname) : String("unknown"), si.source ? String::utf8(si.source) : String("native"), si.line));
+	}
+
+	String stack;
+	for (int64_t i = int64_t(frames.size()) - 1; i >= 0; i--) {
+		stack += stack.is_empty() ? frames[i] : ";" + frames[i];
+	}
+	if (stack.is_empty()) {
+		stack = "<native>";
+	}
+
+	AllocationSite &site = internal->allocation_profile[stack];
+	site.samples++;
+	site.bytes += p_bytes;
+}
+
 Ref<SquirrelNativeFunction> SquirrelVMBase::wrap_callable(const Callable &p_callable, bool p_varargs) {
 	ERR_FAIL_COND_V(p_callable.is_null(), Ref<SquirrelNativeFunction>());
 	GET_VM(Ref<SquirrelNativeFunction>());
@@ -1129,9 +1841,21 @@ int64_t SquirrelVMBase::collect_garbage() {
 	GET_VM(-1);
 	GET_OUTER_VM();
 
-	outer_vm->_vm_internal->clean_memoized_variants();
+	return outer_vm->_vm_internal->collect_garbage(vm);
+}
+
+bool SquirrelVMBase::shrink_stack() {
+	GET_VM(false);
+
+	ERR_FAIL_COND_V_MSG(SQ_FAILED(godot_squirrel_shrink_stack(vm)), false, vformat("Failed to shrink Squirrel stack: %s", get_last_error()));
+
+	return true;
+}
+
+int64_t SquirrelVMBase::get_stack_memory_usage() const {
+	GET_VM(0);
 
-	return sq_collectgarbage(vm);
+	return godot_squirrel_get_stack_memory_usage(vm);
 }
 
 TypedArray<SquirrelVariant> SquirrelVMBase::resurrect_unreachable() {
@@ -1299,6 +2023,34 @@ void SquirrelVM::_bind_methods() {
 
 	ClassDB::bind_method(D_METHOD("clear_interned_variants"), &SquirrelVM::clear_interned_variants);
 
+	ClassDB::bind_method(D_METHOD("set_memory_limit", "memory_limit"), &SquirrelVM::set_memory_limit);
+	ClassDB::bind_method(D_METHOD("get_memory_limit"), &SquirrelVM::get_memory_limit);
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "memory_limit"), "set_memory_limit", "get_memory_limit");
+	ClassDB::bind_method(D_METHOD("get_memory_usage"), &SquirrelVM::get_memory_usage);
+
+	ClassDB::bind_method(D_METHOD("collect_garbage_step", "budget_usec"), &SquirrelVM::collect_garbage_step);
+	ClassDB::bind_method(D_METHOD("set_gc_growth_ratio", "gc_growth_ratio"), &SquirrelVM::set_gc_growth_ratio);
+	ClassDB::bind_method(D_METHOD("get_gc_growth_ratio"), &SquirrelVM::get_gc_growth_ratio);
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "gc_growth_ratio"), "set_gc_growth_ratio", "get_gc_growth_ratio");
+	ClassDB::bind_method(D_METHOD("get_gc_statistics"), &SquirrelVM::get_gc_statistics);
+
+	ClassDB::bind_method(D_METHOD("recycle_thread", "thread"), &SquirrelVM::recycle_thread);
+	ClassDB::bind_method(D_METHOD("set_thread_pool_limit", "thread_pool_limit"), &SquirrelVM::set_thread_pool_limit);
+	ClassDB::bind_method(D_METHOD("get_thread_pool_limit"), &SquirrelVM::get_thread_pool_limit);
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "thread_pool_limit"), "set_thread_pool_limit", "get_thread_pool_limit");
+	ClassDB::bind_method(D_METHOD("get_thread_pool_statistics"), &SquirrelVM::get_thread_pool_statistics);
+	ClassDB::bind_method(D_METHOD("get_heap_census"), &SquirrelVM::get_heap_census);
+	ClassDB::bind_method(D_METHOD("start_allocation_profile", "sample_interval"), &SquirrelVM::start_allocation_profile, DEFVAL(512 * 1024));
+	ClassDB::bind_method(D_METHOD("stop_allocation_profile"), &SquirrelVM::stop_allocation_profile);
+	ClassDB::bind_method(D_METHOD("get_allocation_profile"), &SquirrelVM::get_allocation_profile);
+	ClassDB::bind_method(D_METHOD("take_heap_snapshot"), &SquirrelVM::take_heap_snapshot);
+	ClassDB::bind_static_method(get_class_static(), D_METHOD("diff_heap_snapshots", "before", "after"), &SquirrelVM::diff_heap_snapshots);
+
+	ClassDB::bind_method(D_METHOD("fork"), &SquirrelVM::fork);
+	ClassDB::bind_method(D_METHOD("create_thread_with_root_table", "root_table"), &SquirrelVM::create_thread_with_root_table, DEFVAL(Ref<SquirrelTable>()));
+	ClassDB::bind_method(D_METHOD("save_image"), &SquirrelVM::save_image);
+	ClassDB::bind_method(D_METHOD("load_image", "image", "natives"), &SquirrelVM::load_image, DEFVAL(Dictionary()));
+
 	ClassDB::bind_method(D_METHOD("get_table_default_delegate"), &SquirrelVM::get_table_default_delegate);
 	ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "table_default_delegate", PROPERTY_HINT_RESOURCE_TYPE, SquirrelTable::get_class_static(), PROPERTY_USAGE_READ_ONLY), "", "get_table_default_delegate");
 	ClassDB::bind_method(D_METHOD("get_array_default_delegate"), &SquirrelVM::get_array_default_delegate);
@@ -1349,13 +2101,8 @@ Callable SquirrelVM::get_error_func() const {
 
 #ifndef SQUIRREL_NO_DEBUG
 void SquirrelVM::set_debug_enabled(bool p_debug_enabled) {
-	if (p_debug_enabled && !_debug_enabled) {
-		sq_setnativedebughook(_vm_internal->vm, &SquirrelVMInternal::debug_hook);
-	} else if (!p_debug_enabled && _debug_enabled) {
-		sq_setnativedebughook(_vm_internal->vm, nullptr);
-	}
-
 	_debug_enabled = p_debug_enabled;
+	_vm_internal->update_debug_hook(_debug_enabled);
 }
 
 bool SquirrelVM::is_debug_enabled() const {
@@ -1429,6 +2176,649 @@ Ref<SquirrelTable> SquirrelVM::get_weak_ref_default_delegate() const {
 	return delegate;
 }
 
+void SquirrelVM::set_memory_limit(int64_t p_memory_limit) {
+	ERR_FAIL_NULL(_vm_internal);
+	ERR_FAIL_COND(p_memory_limit < 0);
+
+	_vm_internal->memory.limit = p_memory_limit;
+#ifndef SQUIRREL_NO_DEBUG
+	_vm_internal->update_debug_hook(_debug_enabled);
+#else
+	_vm_internal->update_debug_hook(false);
+#endif
+}
+
+int64_t SquirrelVM::get_memory_limit() const {
+	ERR_FAIL_NULL_V(_vm_internal, 0);
+
+	return _vm_internal->memory.limit;
+}
+
+int64_t SquirrelVM::get_memory_usage() const {
+	ERR_FAIL_NULL_V(_vm_internal, 0);
+
+	return _vm_internal->memory.usage;
+}
+
+void SquirrelVM::start_allocation_profile(int64_t p_sample_interval) {
+	ERR_FAIL_NULL(_vm_internal);
+	ERR_FAIL_COND(p_sample_interval <= 0);
+
+	_vm_internal->allocation_profile.clear();
+	_vm_internal->memory.sample_interval = p_sample_interval;
+	_vm_internal->memory.sample_countdown = p_sample_interval;
+	_vm_internal->memory.on_sample = &SquirrelVMInternal::record_allocation_sample;
+	_vm_internal->memory.sample_userdata = _vm_internal;
+}
+
+void SquirrelVM::stop_allocation_profile() {
+	ERR_FAIL_NULL(_vm_internal);
+
+	_vm_internal->memory.sample_interval = 0;
+}
+
+Dictionary SquirrelVM::get_allocation_profile() const {
+	ERR_FAIL_NULL_V(_vm_internal, Dictionary());
+
+	Dictionary stacks;
+	String collapsed;
+	for (const KeyValue<String, SquirrelVMInternal::AllocationSite> &site : _vm_internal->allocation_profile) {
+		Dictionary entry;
+		entry["samples"] = site.value.samples;
+		entry["bytes"] = site.value.bytes;
+		stacks[site.key] = entry;
+
+		collapsed += vformat("%s %d\n", site.key, site.value.bytes);
+	}
+
+	Dictionary result;
+	result["sample_interval"] = _vm_internal->memory.sample_interval;
+	result["stacks"] = stacks;
+	result["collapsed"] = collapsed;
+	return result;
+}
+
+bool SquirrelVM::collect_garbage_step(int64_t p_budget_usec) {
+	ERR_FAIL_NULL_V(_vm_internal, false);
+
+	const SquirrelVMInternal::GarbageCollectorStatistics &gc = _vm_internal->gc;
+	const int64_t usage = _vm_internal->memory.usage;
+	const int64_t growth = usage - gc.usage_after_last;
+	const int64_t threshold = MAX(int64_t(double(gc.usage_after_last) * _vm_internal->gc_growth_ratio), int64_t(SQUIRREL_GC_MIN_GROWTH));
+	if (growth < threshold) {
+		return false;
+	}
+
+	// a collection always runs to completion, so predict its length from the
+	// last one. past twice the threshold it runs anyway to keep memory bounded.
+	const int64_t predicted_usec = gc.usage_before_last > 0 ? int64_t(double(gc.last_pause_usec) * double(usage) / double(gc.usage_before_last)) : 0;
+	if (predicted_usec > p_budget_usec && growth < threshold * 2) {
+		return false;
+	}
+
+	const SquirrelMemoryScope memory_scope(&_vm_internal->memory, _vm_internal->vm);
+	_vm_internal->collect_garbage(_vm_internal->vm);
+	return true;
+}
+
+void SquirrelVM::set_gc_growth_ratio(double p_gc_growth_ratio) {
+	ERR_FAIL_NULL(_vm_internal);
+	ERR_FAIL_COND(p_gc_growth_ratio < 0.0);
+
+	_vm_internal->gc_growth_ratio = p_gc_growth_ratio;
+}
+
+double SquirrelVM::get_gc_growth_ratio() const {
+	ERR_FAIL_NULL_V(_vm_internal, 0.0);
+
+	return _vm_internal->gc_growth_ratio;
+}
+
+Dictionary SquirrelVM::get_gc_statistics() const {
+	ERR_FAIL_NULL_V(_vm_internal, Dictionary());
+
+	const SquirrelVMInternal::GarbageCollectorStatistics &gc = _vm_internal->gc;
+
+	Dictionary statistics;
+	statistics["collections"] = gc.collections;
+	statistics["last_pause_usec"] = gc.last_pause_usec;
+	statistics["max_pause_usec"] = gc.max_pause_usec;
+	statistics["total_pause_usec"] = gc.total_pause_usec;
+	statistics["last_freed"] = gc.last_freed;
+	statistics["total_freed"] = gc.total_freed;
+	statistics["memory_after_last_collection"] = gc.usage_after_last;
+	return statistics;
+}
+
+bool SquirrelVM::recycle_thread(const Ref<SquirrelThread> &p_thread) {
+	ERR_FAIL_NULL_V(_vm_internal, false);
+	ERR_FAIL_COND_V(p_thread.is_null(), false);
+	ERR_FAIL_COND_V_MSG(!p_thread->is_owned_by(this), false, "Cannot recycle a thread from a different VM.");
+
+	HSQOBJECT &thread = p_thread->_internal->obj;
+	ERR_FAIL_COND_V_MSG(!sq_isthread(thread), false, "Thread has already been recycled.");
+	ERR_FAIL_COND_V_MSG(p_thread->get_state() != IDLE, false, "Only idle threads can be recycled.");
+
+	if (int64_t(_vm_internal->thread_pool.size()) >= _vm_internal->thread_pool_limit) {
+		return false;
+	}
+
+	HSQUIRRELVM vm = _vm_internal->vm;
+	const SquirrelMemoryScope memory_scope(&_vm_internal->memory, vm);
+
+	// the reference held by this wrapper must be the only one, from Squirrel or
+	// from the API, or the thread could still be reached after it is reused
+	ERR_FAIL_COND_V_MSG(sq_getrefcount(vm, &thread) != 1 || godot_squirrel_get_refcount(&thread) != 1, false, "Cannot recycle a thread that is still referenced by Squirrel values.");
+
+	ERR_FAIL_COND_V_MSG(SQ_FAILED(godot_squirrel_reset_thread(thread._unVal.pThread)), false, vformat("Failed to recycle Squirrel thread: %s", p_thread->get_last_error()));
+
+	// the pool takes over the wrapper's reference. the wrapper is left holding
+	// null, so other Refs to it can't reach the thread once it is reused.
+	_vm_internal->ref_objects.erase(thread);
+	_vm_internal->thread_pool.push_back(thread);
+	sq_resetobject(&thread);
+
+	return true;
+}
+
+void SquirrelVM::set_thread_pool_limit(int64_t p_thread_pool_limit) {
+	ERR_FAIL_NULL(_vm_internal);
+	ERR_FAIL_COND(p_thread_pool_limit < 0);
+
+	const SquirrelMemoryScope memory_scope(&_vm_internal->memory, _vm_internal->vm);
+	_vm_internal->thread_pool_limit = p_thread_pool_limit;
+	_vm_internal->trim_thread_pool(p_thread_pool_limit);
+}
+
+int64_t SquirrelVM::get_thread_pool_limit() const {
+	ERR_FAIL_NULL_V(_vm_internal, 0);
+
+	return _vm_internal->thread_pool_limit;
+}
+
+Dictionary SquirrelVM::get_thread_pool_statistics() const {
+	ERR_FAIL_NULL_V(_vm_internal, Dictionary());
+
+	Dictionary statistics;
+	statistics["size"] = int64_t(_vm_internal->thread_pool.size());
+	statistics["hits"] = _vm_internal->thread_pool_hits;
+	statistics["misses"] = _vm_internal->thread_pool_misses;
+	return statistics;
+}
+
+Ref<SquirrelThread> SquirrelVM::create_thread_with_root_table(const Ref<SquirrelTable> &p_root_table) {
+	ERR_FAIL_NULL_V(_vm_internal, Ref<SquirrelThread>());
+	ERR_FAIL_COND_V(p_root_table.is_valid() && !p_root_table->is_owned_by(this), Ref<SquirrelThread>());
+
+	const Ref<SquirrelThread> thread = create_thread();
+	ERR_FAIL_COND_V(thread.is_null(), Ref<SquirrelThread>());
+
+	// closures created by the thread capture its root table, so anything it
+	// imports or compiles resolves globals there rather than here
+	thread->set_root_table(p_root_table.is_valid() ? p_root_table : create_table());
+
+	return thread;
+}
+
+// Variant userdata is shared by value; wrapped objects are not duplicated,
+// except for the math library's generator, which would otherwise tie the
+// random sequences of every fork together
+SQBool SquirrelVMBase::SquirrelVMInternal::copy_variant_userdata(HSQUIRRELVM p_src, HSQUIRRELVM p_dst, const HSQOBJECT *p_obj) {
+	sq_pushobject(p_src, *p_obj);
+	SQUserPointer pointer = nullptr;
+	SQUserPointer object_type_tag = nullptr;
+	const bool ok = SQ_SUCCEEDED(sq_getuserdata(p_src, -1, &pointer, &object_type_tag)) && object_type_tag == SquirrelVariantUserData::type_tag;
+	sq_poptop(p_src);
+
+	if (unlikely(!ok)) {
+		return SQFalse;
+	}
+
+	const SquirrelVariantUserData *svud = reinterpret_cast<const SquirrelVariantUserData *>(pointer);
+
+#ifndef SQUIRREL_NO_RANDOMNUMBERGENERATOR
+	if (svud->is_math_rng) {
+		const Ref<RandomNumberGenerator> rng = svud->variant;
+		ERR_FAIL_COND_V(rng.is_null(), SQFalse);
+
+		Ref<RandomNumberGenerator> copy{ memnew(RandomNumberGenerator) };
+#ifdef SQUIRREL_RANDOMNUMBERGENERATOR_RANDOMSEED
+		copy->randomize();
+#else
+		copy->set_seed(rng->get_seed());
+		copy->set_state(rng->get_state());
+#endif
+		SquirrelVariantUserData::create(p_dst, copy)->is_math_rng = true;
+		return SQTrue;
+	}
+#endif
+
+	// interned values stay interned, so pushing the same value into the fork
+	// finds the copy instead of creating a second userdata
+	if (svud->forget == &forget_interned) {
+		SquirrelVM *dst_vm = reinterpret_cast<SquirrelVM *>(sq_getsharedforeignptr(p_dst));
+		return dst_vm->_vm_internal->push_interned(p_dst, svud->variant) ? SQTrue : SQFalse;
+	}
+
+	SquirrelVariantUserData::create(p_dst, svud->variant);
+	return SQTrue;
+}
+
+Ref<SquirrelVM> SquirrelVM::fork() const {
+	ERR_FAIL_NULL_V(_vm_internal, Ref<SquirrelVM>());
+
+	Ref<SquirrelVM> vm{ memnew(SquirrelVM) };
+	ERR_FAIL_NULL_V(vm->_vm_internal, Ref<SquirrelVM>());
+
+#ifndef SQUIRREL_NO_PRINT
+	vm->_print_func = _print_func;
+	vm->_error_func = _error_func;
+#endif
+#ifndef SQUIRREL_NO_DEBUG
+	vm->set_debug_enabled(_debug_enabled);
+#endif
+	vm->set_memory_limit(_vm_internal->memory.limit);
+	vm->_vm_internal->thread_pool_limit = _vm_internal->thread_pool_limit;
+
+	const SquirrelMemoryScope memory_scope(&vm->_vm_internal->memory, vm->_vm_internal->vm);
+	if (unlikely(SQ_FAILED(godot_squirrel_copy_heap(_vm_internal->vm, vm->_vm_internal->vm, &SquirrelVMInternal::copy_variant_userdata)))) {
+		ERR_FAIL_V_MSG(Ref<SquirrelVM>(), vformat("Failed to fork Squirrel VM: %s", vm->get_last_error()));
+	}
+
+	return vm;
+}
+
+// objects and anything else tied to this process can't be stored in an image
+static bool is_variant_saveable(const Variant &p_value) {
+	switch (p_value.get_type()) {
+		case Variant::OBJECT:
+		case Variant::CALLABLE:
+		case Variant::SIGNAL:
+		case Variant::RID:
+			return false;
+		case Variant::ARRAY: {
+			const Array array = p_value;
+			for (int64_t i = 0; i < array.size(); i++) {
+				if (!is_variant_saveable(array[i])) {
+					return false;
+				}
+			}
+			return true;
+		}
+		case Variant::DICTIONARY: {
+			const Dictionary dictionary = p_value;
+			const Array keys = dictionary.keys();
+			for (int64_t i = 0; i < keys.size(); i++) {
+				if (!is_variant_saveable(keys[i]) || !is_variant_saveable(dictionary[keys[i]])) {
+					return false;
+				}
+			}
+			return true;
+		}
+		default:
+			return true;
+	}
+}
+
+static SQRESULT write_image_userdata(HSQUIRRELVM p_vm, const HSQOBJECT *p_obj, SQWRITEFUNC p_write, SQUserPointer p_up) {
+	sq_pushobject(p_vm, *p_obj);
+	SQUserPointer pointer = nullptr;
+	SQUserPointer object_type_tag = nullptr;
+	Variant value;
+	const bool ok = SQ_SUCCEEDED(sq_getuserdata(p_vm, -1, &pointer, &object_type_tag)) && object_type_tag == SquirrelVariantUserData::type_tag && SquirrelVariantUserData::get(value, p_vm, -1);
+	sq_poptop(p_vm);
+
+	ERR_FAIL_COND_V_MSG(!ok, SQ_ERROR, "Cannot save userdata that was not created by this extension.");
+	ERR_FAIL_COND_V_MSG(!is_variant_saveable(value), SQ_ERROR, vformat("Cannot save a %s in a Squirrel VM image.", Variant::get_type_name(value.get_type())));
+
+	const PackedByteArray bytes = UtilityFunctions::var_to_bytes(value);
+	SQInteger size = bytes.size();
+	if (p_write(p_up, &size, sizeof(size)) != sizeof(size) || p_write(p_up, const_cast<uint8_t *>(bytes.ptr()), size) != size) {
+		return SQ_ERROR;
+	}
+
+	return SQ_OK;
+}
+
+static SQRESULT read_image_userdata(HSQUIRRELVM p_vm, SQREADFUNC p_read, SQUserPointer p_up) {
+	SQInteger size = 0;
+	if (p_read(p_up, &size, sizeof(size)) != sizeof(size) || size < 0) {
+		return SQ_ERROR;
+	}
+
+	PackedByteArray bytes;
+	bytes.resize(size);
+	if (p_read(p_up, bytes.ptrw(), size) != size) {
+		return SQ_ERROR;
+	}
+
+	SquirrelVariantUserData::create(p_vm, UtilityFunctions::bytes_to_var(bytes));
+	return SQ_OK;
+}
+
+// natives passed to load_image take precedence over the ones already in the VM
+static SQBool resolve_image_native(HSQUIRRELVM p_vm, const SQChar *p_name, void *p_userdata) {
+	const Dictionary &natives = *reinterpret_cast<const Dictionary *>(p_userdata);
+	const String name = String::utf8(p_name);
+	if (!natives.has(name)) {
+		return SQFalse;
+	}
+
+	SquirrelVM *outer_vm = reinterpret_cast<SquirrelVM *>(sq_getsharedforeignptr(p_vm));
+	return outer_vm->push_stack(natives[name]) ? SQTrue : SQFalse;
+}
+
+PackedByteArray SquirrelVM::save_image() const {
+	ERR_FAIL_NULL_V(_vm_internal, PackedByteArray());
+
+	const SquirrelMemoryScope memory_scope(&_vm_internal->memory, _vm_internal->vm);
+	SquirrelByteCodeWriter writer;
+	if (unlikely(SQ_FAILED(godot_squirrel_save_image(_vm_internal->vm, &SquirrelByteCodeWriter::write, &writer, &write_image_userdata)))) {
+		ERR_FAIL_V_MSG(PackedByteArray(), vformat("Failed to save Squirrel VM image: %s", get_last_error()));
+	}
+
+	return writer.finish();
+}
+
+Error SquirrelVM::load_image(const PackedByteArray &p_image, const Dictionary &p_natives) {
+	ERR_FAIL_NULL_V(_vm_internal, ERR_UNCONFIGURED);
+
+	const SquirrelMemoryScope memory_scope(&_vm_internal->memory, _vm_internal->vm);
+	_vm_internal->memoized_variants.clear();
+	_vm_internal->memoized_objects.clear();
+	_vm_internal->trim_thread_pool(0);
+
+	SquirrelByteCodeReader reader{ .data = p_image.ptr(), .size = p_image.size() };
+	if (unlikely(SQ_FAILED(godot_squirrel_load_image(_vm_internal->vm, &SquirrelByteCodeReader::read, &reader, &read_image_userdata, &resolve_image_native, const_cast<Dictionary *>(&p_natives))))) {
+		ERR_FAIL_V_MSG(ERR_FILE_CORRUPT, vformat("Failed to load Squirrel VM image: %s", get_last_error()));
+	}
+
+	return OK;
+}
+
+static const char *get_heap_type_name(SQObjectType p_type) {
+	switch (p_type) {
+		case OT_STRING:
+			return "string";
+		case OT_TABLE:
+			return "table";
+		case OT_ARRAY:
+			return "array";
+		case OT_USERDATA:
+			return "userdata";
+		case OT_CLOSURE:
+			return "closure";
+		case OT_NATIVECLOSURE:
+			return "native_closure";
+		case OT_GENERATOR:
+			return "generator";
+		case OT_THREAD:
+			return "thread";
+		case OT_FUNCPROTO:
+			return "function_proto";
+		case OT_CLASS:
+			return "class";
+		case OT_INSTANCE:
+			return "instance";
+		case OT_WEAKREF:
+			return "weakref";
+		case OT_OUTER:
+			return "outer";
+		default:
+			return "unknown";
+	}
+}
+
+namespace {
+struct SquirrelHeapCensus {
+	HSQUIRRELVM vm = nullptr;
+	HashMap<uint64_t, String> class_names;
+	Dictionary types;
+	Dictionary instances;
+	Dictionary userdata;
+	int64_t count = 0;
+	int64_t bytes = 0;
+
+	static void add(Dictionary &r_totals, const String &p_key, int64_t p_bytes) {
+		Dictionary entry = r_totals.get(p_key, Dictionary());
+		entry["count"] = int64_t(entry.get("count", 0)) + 1;
+		entry["bytes"] = int64_t(entry.get("bytes", 0)) + p_bytes;
+		r_totals[p_key] = entry;
+	}
+
+	// classes have no names of their own; use the slot they're stored in
+	void find_class_names() {
+		for (int i = 0; i < 2; i++) {
+			if (i == 0) {
+				sq_pushroottable(vm);
+			} else {
+				sq_pushconsttable(vm);
+			}
+
+			sq_pushnull(vm);
+			while (SQ_SUCCEEDED(sq_next(vm, -2))) {
+				HSQOBJECT value;
+				const SQChar *name = nullptr;
+				if (sq_gettype(vm, -1) == OT_CLASS && SQ_SUCCEEDED(sq_getstring(vm, -2, &name)) && SQ_SUCCEEDED(sq_getstackobj(vm, -1, &value))) {
+					class_names.insert(uint64_t(value._unVal.raw), String::utf8(name));
+				}
+				sq_pop(vm, 2);
+			}
+			sq_pop(vm, 2);
+		}
+	}
+
+	String get_class_name(const HSQOBJECT &p_instance) {
+		sq_pushobject(vm, p_instance);
+		sq_getclass(vm, -1);
+		HSQOBJECT cls;
+		sq_getstackobj(vm, -1, &cls);
+		sq_pop(vm, 2);
+
+		const HashMap<uint64_t, String>::ConstIterator name = class_names.find(uint64_t(cls._unVal.raw));
+		return name != class_names.end() ? name->value : vformat("<class 0x%x>", uint64_t(cls._unVal.raw));
+	}
+
+	String get_userdata_type(const HSQOBJECT &p_userdata) {
+		sq_pushobject(vm, p_userdata);
+		SQUserPointer pointer = nullptr;
+		SQUserPointer object_type_tag = nullptr;
+		Variant value;
+		const bool is_variant = SQ_SUCCEEDED(sq_getuserdata(vm, -1, &pointer, &object_type_tag)) && object_type_tag == SquirrelVariantUserData::type_tag && SquirrelVariantUserData::get(value, vm, -1);
+		sq_poptop(vm);
+
+		if (!is_variant) {
+			return "native";
+		}
+		if (value.get_type() == Variant::OBJECT && value.get_validated_object() != nullptr) {
+			return value.get_validated_object()->get_class();
+		}
+		return Variant::get_type_name(value.get_type());
+	}
+
+	static void visit(void *p_census, const HSQOBJECT *p_obj, SQInteger p_bytes) {
+		SquirrelHeapCensus *census = reinterpret_cast<SquirrelHeapCensus *>(p_census);
+		census->count++;
+		census->bytes += p_bytes;
+		add(census->types, get_heap_type_name(sq_type(*p_obj)), p_bytes);
+
+		if (sq_isinstance(*p_obj)) {
+			add(census->instances, census->get_class_name(*p_obj), p_bytes);
+		} else if (sq_isuserdata(*p_obj)) {
+			add(census->userdata, census->get_userdata_type(*p_obj), p_bytes);
+		}
+	}
+};
+
+struct SquirrelHeapSnapshot {
+	PackedInt64Array ids;
+	PackedStringArray types;
+	PackedInt64Array bytes;
+	PackedStringArray paths;
+	PackedStringArray root_names;
+
+	static String format_edge(const char *p_kind, const HSQOBJECT *p_key) {
+		const String kind = p_kind;
+		const bool named = kind == "slot" || kind == "member" || kind == "field";
+		if (p_key != nullptr && named && sq_isstring(*p_key)) {
+			return "." + String::utf8(sq_objtostring(p_key));
+		}
+		if (p_key != nullptr && (named || kind == "index") && sq_isinteger(*p_key)) {
+			return vformat("[%d]", sq_objtointeger(p_key));
+		}
+		if (p_key != nullptr && sq_isinteger(*p_key)) {
+			return vformat(".<%s %d>", kind, sq_objtointeger(p_key));
+		}
+		return vformat(".<%s>", kind);
+	}
+
+	static void visit(void *p_snapshot, const HSQOBJECT *p_obj, SQInteger p_bytes, SQInteger p_parent, const SQChar *p_kind, const HSQOBJECT *p_key) {
+		SquirrelHeapSnapshot *snapshot = reinterpret_cast<SquirrelHeapSnapshot *>(p_snapshot);
+		snapshot->ids.push_back(int64_t(p_obj->_unVal.raw));
+		snapshot->types.push_back(get_heap_type_name(sq_type(*p_obj)));
+		snapshot->bytes.push_back(p_bytes);
+		if (p_parent < 0) {
+			snapshot->paths.push_back(snapshot->root_names[sq_objtointeger(p_key)]);
+		} else {
+			snapshot->paths.push_back(snapshot->paths[p_parent] + format_edge(p_kind, p_key));
+		}
+	}
+};
+} //namespace
+
+Dictionary SquirrelVM::get_heap_census() const {
+	ERR_FAIL_NULL_V(_vm_internal, Dictionary());
+
+	const SquirrelMemoryScope memory_scope(&_vm_internal->memory, _vm_internal->vm);
+
+	SquirrelHeapCensus census;
+	census.vm = _vm_internal->vm;
+	census.find_class_names();
+
+	if (unlikely(SQ_FAILED(godot_squirrel_heap_census(_vm_internal->vm, &SquirrelHeapCensus::visit, &census)))) {
+		ERR_FAIL_V_MSG(Dictionary(), vformat("Failed to take Squirrel heap census: %s", get_last_error()));
+	}
+
+	Dictionary result;
+	result["count"] = census.count;
+	result["bytes"] = census.bytes;
+	result["types"] = census.types;
+	result["instances"] = census.instances;
+	result["userdata"] = census.userdata;
+	return result;
+}
+
+Dictionary SquirrelVM::take_heap_snapshot() const {
+	ERR_FAIL_NULL_V(_vm_internal, Dictionary());
+
+	HSQUIRRELVM vm = _vm_internal->vm;
+	const SquirrelMemoryScope memory_scope(&_vm_internal->memory, _vm_internal->vm);
+
+	SquirrelHeapSnapshot snapshot;
+	LocalVector<HSQOBJECT> roots;
+
+	const auto add_root = [&](const String &p_name) {
+		HSQOBJECT root;
+		sq_getstackobj(vm, -1, &root);
+		sq_poptop(vm);
+		roots.push_back(root);
+		snapshot.root_names.push_back(p_name);
+	};
+	sq_pushroottable(vm);
+	add_root("root");
+	sq_pushregistrytable(vm);
+	add_root("registry");
+	sq_pushconsttable(vm);
+	add_root("consts");
+
+	// values held by Godot through SquirrelVariant references
+	for (const KeyValue<HSQOBJECT, SquirrelVariant *> &ref : _vm_internal->ref_objects) {
+		roots.push_back(ref.key);
+		snapshot.root_names.push_back(vformat("godot(%s)", ref.value->get_class()));
+	}
+
+	if (unlikely(SQ_FAILED(godot_squirrel_walk_heap(vm, roots.ptr(), roots.size(), &SquirrelHeapSnapshot::visit, &snapshot)))) {
+		ERR_FAIL_V_MSG(Dictionary(), vformat("Failed to take Squirrel heap snapshot: %s", get_last_error()));
+	}
+
+	Dictionary result;
+	result["ids"] = snapshot.ids;
+	result["types"] = snapshot.types;
+	result["bytes"] = snapshot.bytes;
+	result["paths"] = snapshot.paths;
+	return result;
+}
+
+Dictionary SquirrelVM::diff_heap_snapshots(const Dictionary &p_before, const Dictionary &p_after) {
+	const PackedInt64Array before_ids = p_before.get("ids", PackedInt64Array());
+	const PackedStringArray before_types = p_before.get("types", PackedStringArray());
+	const PackedInt64Array before_bytes = p_before.get("bytes", PackedInt64Array());
+	const PackedStringArray before_paths = p_before.get("paths", PackedStringArray());
+	const PackedInt64Array after_ids = p_after.get("ids", PackedInt64Array());
+	const PackedStringArray after_types = p_after.get("types", PackedStringArray());
+	const PackedInt64Array after_bytes = p_after.get("bytes", PackedInt64Array());
+	const PackedStringArray after_paths = p_after.get("paths", PackedStringArray());
+
+	ERR_FAIL_COND_V_MSG(before_ids.size() != before_types.size() || before_ids.size() != before_bytes.size() || before_ids.size() != before_paths.size(), Dictionary(), "Invalid heap snapshot.");
+	ERR_FAIL_COND_V_MSG(after_ids.size() != after_types.size() || after_ids.size() != after_bytes.size() || after_ids.size() != after_paths.size(), Dictionary(), "Invalid heap snapshot.");
+
+	// an address can be reused by a different object, so the type is part of the identity
+	HashMap<int64_t, int64_t> before_index;
+	for (int64_t i = 0; i < before_ids.size(); i++) {
+		before_index.insert(before_ids[i], i);
+	}
+	LocalVector<bool> kept;
+	kept.resize(before_ids.size());
+	for (int64_t i = 0; i < before_ids.size(); i++) {
+		kept[i] = false;
+	}
+
+	Array added;
+	Array removed;
+	Dictionary by_type;
+	int64_t bytes_added = 0;
+	int64_t bytes_removed = 0;
+
+	const auto record = [&](Array &r_list, const String &p_type, int64_t p_bytes, const String &p_path, int64_t p_sign) {
+		Dictionary entry;
+		entry["type"] = p_type;
+		entry["bytes"] = p_bytes;
+		entry["path"] = p_path;
+		r_list.push_back(entry);
+
+		Dictionary totals = by_type.get(p_type, Dictionary());
+		totals["count"] = int64_t(totals.get("count", 0)) + p_sign;
+		totals["bytes"] = int64_t(totals.get("bytes", 0)) + p_sign * p_bytes;
+		by_type[p_type] = totals;
+	};
+
+	for (int64_t i = 0; i < after_ids.size(); i++) {
+		const HashMap<int64_t, int64_t>::ConstIterator match = before_index.find(after_ids[i]);
+		if (match != before_index.end() && before_types[match->value] == after_types[i]) {
+			kept[match->value] = true;
+			continue;
+		}
+
+		record(added, after_types[i], after_bytes[i], after_paths[i], 1);
+		bytes_added += after_bytes[i];
+	}
+
+	for (int64_t i = 0; i < before_ids.size(); i++) {
+		if (!kept[i]) {
+			record(removed, before_types[i], before_bytes[i], before_paths[i], -1);
+			bytes_removed += before_bytes[i];
+		}
+	}
+
+	Dictionary result;
+	result["added"] = added;
+	result["removed"] = removed;
+	result["bytes_added"] = bytes_added;
+	result["bytes_removed"] = bytes_removed;
+	result["by_type"] = by_type;
+	return result;
+}
+
 String SquirrelVM::_to_string() const {
 	return vformat("<%s:%d>", get_class(), get_instance_id());
 }
@@ -1490,8 +2880,7 @@ bool SquirrelVariant::is_owned_by(const Ref<SquirrelVMBase> &p_vm_or_thread) con
 uint64_t SquirrelVariant::get_squirrel_reference_count() const {
 	ERR_FAIL_COND_V(sq_isnull(_internal->obj), 0);
 
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL_V(vm, 0);
+	GET_VARIANT_VM(0);
 
 	return sq_getrefcount(vm->_vm_internal->vm, &_internal->obj);
 }
@@ -1508,8 +2897,7 @@ Ref<SquirrelIterator> SquirrelVariant::iterate() const {
 Ref<SquirrelWeakRef> SquirrelVariant::weak_ref() const {
 	ERR_FAIL_COND_V(sq_isnull(_internal->obj), Ref<SquirrelWeakRef>());
 
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL_V(vm, Ref<SquirrelWeakRef>());
+	GET_VARIANT_VM(Ref<SquirrelWeakRef>());
 
 	sq_pushobject(vm->_vm_internal->vm, _internal->obj);
 	sq_weakref(vm->_vm_internal->vm, -1);
@@ -1522,8 +2910,7 @@ Ref<SquirrelWeakRef> SquirrelVariant::weak_ref() const {
 
 String SquirrelVariant::_to_string() const {
 	if (likely(!sq_isnull(_internal->obj))) {
-		SquirrelVM *vm = _get_vm();
-		ERR_FAIL_NULL_V(vm, "Squirrel object from disposed VM");
+		GET_VARIANT_VM("Squirrel object from disposed VM");
 
 		sq_pushobject(vm->_vm_internal->vm, _internal->obj);
 		if (unlikely(SQ_FAILED(sq_tostring(vm->_vm_internal->vm, -1)))) {
@@ -1563,8 +2950,7 @@ void SquirrelTable::_bind_methods() {
 }
 
 bool SquirrelTable::set_delegate(const Ref<SquirrelTable> &p_delegate) {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL_V(vm, false);
+	GET_VARIANT_VM(false);
 
 	ERR_FAIL_COND_V(!sq_istable(_internal->obj), false);
 	ERR_FAIL_COND_V(p_delegate.is_valid() && !p_delegate->is_owned_by(vm), false);
@@ -1584,8 +2970,7 @@ bool SquirrelTable::set_delegate(const Ref<SquirrelTable> &p_delegate) {
 }
 
 Ref<SquirrelTable> SquirrelTable::get_delegate() const {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL_V(vm, Ref<SquirrelTable>());
+	GET_VARIANT_VM(Ref<SquirrelTable>());
 
 	ERR_FAIL_COND_V(!sq_istable(_internal->obj), Ref<SquirrelTable>());
 
@@ -1599,8 +2984,7 @@ Ref<SquirrelTable> SquirrelTable::get_delegate() const {
 }
 
 bool SquirrelTable::new_slot(const Variant &p_key, const Variant &p_value) {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL_V(vm, false);
+	GET_VARIANT_VM(false);
 
 	ERR_FAIL_COND_V(!sq_istable(_internal->obj), false);
 
@@ -1626,8 +3010,7 @@ bool SquirrelTable::new_slot(const Variant &p_key, const Variant &p_value) {
 }
 
 bool SquirrelTable::set_slot(const Variant &p_key, const Variant &p_value, bool p_raw) {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL_V(vm, false);
+	GET_VARIANT_VM(false);
 
 	ERR_FAIL_COND_V(!sq_istable(_internal->obj), false);
 
@@ -1653,8 +3036,7 @@ bool SquirrelTable::set_slot(const Variant &p_key, const Variant &p_value, bool
 }
 
 bool SquirrelTable::has_slot(const Variant &p_key, bool p_raw) const {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL_V(vm, false);
+	GET_VARIANT_VM(false);
 
 	ERR_FAIL_COND_V(!sq_istable(_internal->obj), false);
 
@@ -1673,8 +3055,7 @@ bool SquirrelTable::has_slot(const Variant &p_key, bool p_raw) const {
 }
 
 Variant SquirrelTable::get_slot(const Variant &p_key, bool p_raw) const {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL_V(vm, nullptr);
+	GET_VARIANT_VM(nullptr);
 
 	ERR_FAIL_COND_V(!sq_istable(_internal->obj), nullptr);
 
@@ -1701,8 +3082,7 @@ Variant SquirrelTable::get_slot(const Variant &p_key, bool p_raw) const {
 }
 
 void SquirrelTable::delete_slot(const Variant &p_key, bool p_raw) {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL(vm);
+	GET_VARIANT_VM();
 
 	ERR_FAIL_COND(!sq_istable(_internal->obj));
 
@@ -1723,8 +3103,7 @@ void SquirrelTable::delete_slot(const Variant &p_key, bool p_raw) {
 }
 
 int64_t SquirrelTable::size() const {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL_V(vm, 0);
+	GET_VARIANT_VM(0);
 
 	ERR_FAIL_COND_V(!sq_istable(_internal->obj), 0);
 
@@ -1736,8 +3115,7 @@ int64_t SquirrelTable::size() const {
 }
 
 void SquirrelTable::clear() {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL(vm);
+	GET_VARIANT_VM();
 
 	ERR_FAIL_COND(!sq_istable(_internal->obj));
 
@@ -1747,8 +3125,7 @@ void SquirrelTable::clear() {
 }
 
 Ref<SquirrelTable> SquirrelTable::duplicate() const {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL_V(vm, Ref<SquirrelTable>());
+	GET_VARIANT_VM(Ref<SquirrelTable>());
 
 	ERR_FAIL_COND_V(!sq_istable(_internal->obj), Ref<SquirrelTable>());
 
@@ -1762,8 +3139,7 @@ Ref<SquirrelTable> SquirrelTable::duplicate() const {
 }
 
 bool SquirrelTable::wrap_callables(const TypedDictionary<String, Callable> &p_callables, bool p_varargs) {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL_V(vm, false);
+	GET_VARIANT_VM(false);
 
 	ERR_FAIL_COND_V(!sq_istable(_internal->obj), false);
 
@@ -1801,8 +3177,7 @@ void SquirrelArray::_bind_methods() {
 }
 
 bool SquirrelArray::set_item(int64_t p_index, const Variant &p_value) {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL_V(vm, false);
+	GET_VARIANT_VM(false);
 
 	ERR_FAIL_COND_V(!sq_isarray(_internal->obj), false);
 
@@ -1824,8 +3199,7 @@ bool SquirrelArray::set_item(int64_t p_index, const Variant &p_value) {
 }
 
 Variant SquirrelArray::get_item(int64_t p_index) const {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL_V(vm, nullptr);
+	GET_VARIANT_VM(nullptr);
 
 	ERR_FAIL_COND_V(!sq_isarray(_internal->obj), nullptr);
 
@@ -1843,8 +3217,7 @@ Variant SquirrelArray::get_item(int64_t p_index) const {
 }
 
 bool SquirrelArray::append(const Variant &p_value) {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL_V(vm, false);
+	GET_VARIANT_VM(false);
 
 	ERR_FAIL_COND_V(!sq_isarray(_internal->obj), false);
 
@@ -1863,8 +3236,7 @@ bool SquirrelArray::append(const Variant &p_value) {
 }
 
 bool SquirrelArray::insert(int64_t p_index, const Variant &p_value) {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL_V(vm, false);
+	GET_VARIANT_VM(false);
 
 	ERR_FAIL_COND_V(!sq_isarray(_internal->obj), false);
 
@@ -1883,8 +3255,7 @@ bool SquirrelArray::insert(int64_t p_index, const Variant &p_value) {
 }
 
 bool SquirrelArray::remove(int64_t p_index) {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL_V(vm, false);
+	GET_VARIANT_VM(false);
 
 	ERR_FAIL_COND_V(!sq_isarray(_internal->obj), false);
 
@@ -1898,8 +3269,7 @@ bool SquirrelArray::remove(int64_t p_index) {
 }
 
 Variant SquirrelArray::pop_back() {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL_V(vm, nullptr);
+	GET_VARIANT_VM(nullptr);
 
 	ERR_FAIL_COND_V(!sq_isarray(_internal->obj), nullptr);
 
@@ -1916,8 +3286,7 @@ Variant SquirrelArray::pop_back() {
 }
 
 bool SquirrelArray::resize(int64_t p_size) {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL_V(vm, false);
+	GET_VARIANT_VM(false);
 
 	ERR_FAIL_COND_V(!sq_isarray(_internal->obj), false);
 
@@ -1931,8 +3300,7 @@ bool SquirrelArray::resize(int64_t p_size) {
 }
 
 int64_t SquirrelArray::size() const {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL_V(vm, 0);
+	GET_VARIANT_VM(0);
 
 	ERR_FAIL_COND_V(!sq_isarray(_internal->obj), 0);
 
@@ -1944,8 +3312,7 @@ int64_t SquirrelArray::size() const {
 }
 
 void SquirrelArray::reverse() {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL(vm);
+	GET_VARIANT_VM();
 
 	ERR_FAIL_COND(!sq_isarray(_internal->obj));
 
@@ -1955,8 +3322,7 @@ void SquirrelArray::reverse() {
 }
 
 void SquirrelArray::clear() {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL(vm);
+	GET_VARIANT_VM();
 
 	ERR_FAIL_COND(!sq_isarray(_internal->obj));
 
@@ -1966,8 +3332,7 @@ void SquirrelArray::clear() {
 }
 
 Ref<SquirrelArray> SquirrelArray::duplicate() const {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL_V(vm, Ref<SquirrelArray>());
+	GET_VARIANT_VM(Ref<SquirrelArray>());
 
 	ERR_FAIL_COND_V(!sq_isarray(_internal->obj), Ref<SquirrelArray>());
 
@@ -1990,8 +3355,7 @@ void SquirrelUserData::_bind_methods() {
 }
 
 bool SquirrelUserData::set_delegate(const Ref<SquirrelTable> &p_delegate) {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL_V(vm, false);
+	GET_VARIANT_VM(false);
 
 	ERR_FAIL_COND_V(!sq_isuserdata(_internal->obj), false);
 	ERR_FAIL_COND_V(p_delegate.is_valid() && !p_delegate->is_owned_by(vm), false);
@@ -2011,8 +3375,7 @@ bool SquirrelUserData::set_delegate(const Ref<SquirrelTable> &p_delegate) {
 }
 
 Ref<SquirrelTable> SquirrelUserData::get_delegate() const {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL_V(vm, Ref<SquirrelTable>());
+	GET_VARIANT_VM(Ref<SquirrelTable>());
 
 	ERR_FAIL_COND_V(!sq_isuserdata(_internal->obj), Ref<SquirrelTable>());
 
@@ -2033,8 +3396,7 @@ bool SquirrelUserData::is_variant() const {
 }
 
 Variant SquirrelUserData::get_variant() const {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL_V(vm, nullptr);
+	GET_VARIANT_VM(nullptr);
 
 	sq_pushobject(vm->_vm_internal->vm, _internal->obj);
 	Variant value;
@@ -2059,8 +3421,7 @@ void SquirrelAnyFunction::_bind_methods() {
 }
 
 String SquirrelAnyFunction::get_name() const {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL_V(vm, String());
+	GET_VARIANT_VM(String());
 
 	sq_pushobject(vm->_vm_internal->vm, _internal->obj);
 
@@ -2076,8 +3437,7 @@ String SquirrelAnyFunction::get_name() const {
 }
 
 Ref<SquirrelAnyFunction> SquirrelAnyFunction::bind_env(const Ref<SquirrelVariant> &p_env) const {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL_V(vm, nullptr);
+	GET_VARIANT_VM(nullptr);
 
 	sq_pushobject(vm->_vm_internal->vm, _internal->obj);
 	if (unlikely(!vm->push_stack(p_env))) {
@@ -2105,8 +3465,7 @@ void SquirrelFunction::_bind_methods() {
 }
 
 void SquirrelFunction::set_root_table(const Ref<SquirrelTable> &p_root_table) {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL(vm);
+	GET_VARIANT_VM();
 
 	ERR_FAIL_COND(p_root_table.is_null());
 
@@ -2125,8 +3484,7 @@ void SquirrelFunction::set_root_table(const Ref<SquirrelTable> &p_root_table) {
 }
 
 Ref<SquirrelTable> SquirrelFunction::get_root_table() const {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL_V(vm, Ref<SquirrelTable>());
+	GET_VARIANT_VM(Ref<SquirrelTable>());
 
 	sq_pushobject(vm->_vm_internal->vm, _internal->obj);
 	if (unlikely(SQ_FAILED(sq_getclosureroot(vm->_vm_internal->vm, -1)))) {
@@ -2141,8 +3499,7 @@ Ref<SquirrelTable> SquirrelFunction::get_root_table() const {
 }
 
 Array SquirrelFunction::get_outer_values() const {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL_V(vm, Array());
+	GET_VARIANT_VM(Array());
 
 	sq_pushobject(vm->_vm_internal->vm, _internal->obj);
 	SQInteger nparamsmin = 0;
@@ -2177,8 +3534,7 @@ void SquirrelNativeFunction::_bind_methods() {
 }
 
 void SquirrelNativeFunction::set_name(const String &p_name) {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL(vm);
+	GET_VARIANT_VM();
 
 	sq_pushobject(vm->_vm_internal->vm, _internal->obj);
 	sq_setnativeclosurename(vm->_vm_internal->vm, -1, p_name.utf8());
@@ -2190,8 +3546,7 @@ String SquirrelNativeFunction::get_name() const {
 }
 
 bool SquirrelNativeFunction::set_params_check(int64_t p_min_args, int64_t p_max_args, const String &p_type_mask) {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL_V(vm, false);
+	GET_VARIANT_VM(false);
 
 	ERR_FAIL_COND_V(!sq_isnativeclosure(_internal->obj), false);
 
@@ -2232,8 +3587,7 @@ void SquirrelInstance::_bind_methods() {
 }
 
 Ref<SquirrelInstance> SquirrelInstance::duplicate() const {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL_V(vm, Ref<SquirrelInstance>());
+	GET_VARIANT_VM(Ref<SquirrelInstance>());
 
 	ERR_FAIL_COND_V(!sq_isinstance(_internal->obj), Ref<SquirrelInstance>());
 
@@ -2252,8 +3606,7 @@ void SquirrelWeakRef::_bind_methods() {
 }
 
 Variant SquirrelWeakRef::get_object() const {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL_V(vm, nullptr);
+	GET_VARIANT_VM(nullptr);
 
 	ERR_FAIL_COND_V(!sq_isweakref(_internal->obj), nullptr);
 
@@ -2270,8 +3623,7 @@ Variant SquirrelWeakRef::get_object() const {
 }
 
 bool SquirrelWeakRef::is_valid() const {
-	SquirrelVM *vm = _get_vm();
-	ERR_FAIL_NULL_V(vm, false);
+	GET_VARIANT_VM(false);
 
 	ERR_FAIL_COND_V(!sq_isweakref(_internal->obj), false);
 